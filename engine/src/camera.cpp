@@ -7,10 +7,12 @@ namespace TremorEngine {
 
 	Camera::Camera(void): x(0.0), y(0.0), z(0.0), yaw(0.0), fov(M_PI/3.0), maxDist(64.0) {
 		setPitch(0.0);
+		updateDirection();
 	}
 
 	Camera::Camera(double x, double y, double z, double yaw, double gPitch, double fov, double maxDist): x(x), y(y), z(z), yaw(yaw), fov(fov), maxDist(maxDist) {
 		setPitch(gPitch);
+		updateDirection();
 	}
 
 	double Camera::getX(void) const {
@@ -42,17 +44,48 @@ namespace TremorEngine {
 	}
 
 	double Camera::getScreenDistance(int windowWidth) const {
-		return windowWidth/(2.0*tan(getFov()/2.0));
+		return windowWidth/(2.0*fovTan);
+	}
+
+	double Camera::getPitchScreenOffset(int windowWidth) const {
+		return pitchTan*getScreenDistance(windowWidth);
+	}
+
+	double Camera::getDirX(void) const {
+		return dirX;
+	}
+
+	double Camera::getDirY(void) const {
+		return dirY;
+	}
+
+	double Camera::getPlaneX(void) const {
+		return planeX;
+	}
+
+	double Camera::getPlaneY(void) const {
+		return planeY;
+	}
+
+	void Camera::getColumnDirection(int x, int windowWidth, double *rayDirX, double *rayDirY) const {
+		// Move along the plane in proportion to the column's offset from the centre of the screen, then normalise.
+		double planeFraction=(x-windowWidth/2)/(0.5*windowWidth);
+		double unnormalisedX=dirX+planeX*planeFraction;
+		double unnormalisedY=dirY+planeY*planeFraction;
+		double length=sqrt(unnormalisedX*unnormalisedX+unnormalisedY*unnormalisedY);
+		*rayDirX=unnormalisedX/length;
+		*rayDirY=unnormalisedY/length;
 	}
 
 	void Camera::getTargetInfo(double x, double y, double yaw, double *visibleAngle, double *bearingAngle, double *distance) const {
 		double dx=getX()-x;
 		double dy=getY()-y;
 
+		double angle=(visibleAngle!=NULL || bearingAngle!=NULL ? atan2(dy, dx) : 0.0);
 		if (visibleAngle!=NULL)
-			*visibleAngle=atan2(dy, dx)+yaw;
+			*visibleAngle=angle+yaw;
 		if (bearingAngle!=NULL)
-			*bearingAngle=atan2(dy, dx)-getYaw();
+			*bearingAngle=angle-getYaw();
 		if (distance!=NULL)
 			*distance=sqrt(dx*dx+dy*dy);
 	}
@@ -75,6 +108,7 @@ namespace TremorEngine {
 
 	void Camera::setYaw(double newYaw) {
 		yaw=newYaw;
+		updateDirection();
 	}
 
 	void Camera::setPitch(double newPitch) {
@@ -83,23 +117,33 @@ namespace TremorEngine {
 		if (newPitch>M_PI/2.0)
 			newPitch=M_PI/2.0;
 		pitchValue=newPitch;
+		pitchTan=tan(pitchValue);
 	}
 
 	void Camera::move(double delta) {
-		x+=cos(yaw)*delta;
-		y+=sin(yaw)*delta;
+		x+=dirX*delta;
+		y+=dirY*delta;
 	}
 
 	void Camera::strafe(double delta) {
-		x+=-sin(yaw)*delta;
-		y+=cos(yaw)*delta;
+		x+=-dirY*delta;
+		y+=dirX*delta;
 	}
 
 	void Camera::turn(double delta) {
 		yaw+=delta;
+		updateDirection();
 	}
 
 	void Camera::pitch(double delta) {
 		setPitch(pitchValue+delta);
 	}
+
+	void Camera::updateDirection(void) {
+		dirX=cos(yaw);
+		dirY=sin(yaw);
+		fovTan=tan(fov/2.0);
+		planeX=-dirY*fovTan;
+		planeY=dirX*fovTan;
+	}
 };
@@ -18,6 +18,15 @@ namespace TremorEngine {
 		double getFov(void) const ;
 		double getMaxDist(void) const ;
 		double getScreenDistance(int windowWidth) const ; // take our FOV and window width and determine how far the virtual screen must be from the camera
+		double getPitchScreenOffset(int windowWidth) const ; // how far (in pixels) the view is shifted vertically by the pitch, for a screen at getScreenDistance(windowWidth)
+
+		// Direction and plane vectors - direction is the unit vector along the yaw, and plane is perpendicular to it (to the right), reaching the edge of the field of view.
+		// These are kept up to date as the camera is turned, so do not need recomputing from the angles.
+		double getDirX(void) const ;
+		double getDirY(void) const ;
+		double getPlaneX(void) const ;
+		double getPlaneY(void) const ;
+		void getColumnDirection(int x, int windowWidth, double *rayDirX, double *rayDirY) const ; // unit vector of the ray seen through the given screen column
 
 		// For the following getTargetInfo functions, any of the out variables can be NULL if not interested in that value.
 		// visibleAngle represents which side of the target is showing to us
@@ -42,6 +51,12 @@ namespace TremorEngine {
 		double yaw, pitchValue;
 		double fov; // Field-of-view, radians.
 		double maxDist; // Maximum viewing distance.
+
+		double dirX, dirY, planeX, planeY; // see getDirX etc.
+		double fovTan; // tan(fov/2)
+		double pitchTan;
+
+		void updateDirection(void); // updates dirX etc. from yaw and fov
 	};
 
 };
@@ -17,3 +17,29 @@ void Colour::mul(double factor) {
 	else
 		b*=factor;
 }
+
+PackedColour PackedColour::fromColour(const Colour &colour) {
+	uint32_t a=colour.a;
+	uint32_t r=(colour.r*a+127)/255, g=(colour.g*a+127)/255, b=(colour.b*a+127)/255;
+
+	PackedColour result;
+	result.value=(a<<24)|(r<<16)|(g<<8)|b;
+	return result;
+}
+
+Colour PackedColour::toColour(void) const {
+	Colour colour;
+	colour.a=getA();
+	if (colour.a==255) {
+		colour.r=getR();
+		colour.g=getG();
+		colour.b=getB();
+	} else if (colour.a==0)
+		colour.r=colour.g=colour.b=0;
+	else {
+		colour.r=(getR()*255+colour.a/2)/colour.a;
+		colour.g=(getG()*255+colour.a/2)/colour.a;
+		colour.b=(getB()*255+colour.a/2)/colour.a;
+	}
+	return colour;
+}
@@ -10,4 +10,57 @@ public:
 	void mul(double factor); // does not affect alpha
 };
 
+// Colour packed into 32 bits in the same layout as SDL_PIXELFORMAT_ARGB8888 (i.e. 0xAARRGGBB), with r, g and b premultiplied by alpha.
+// Fully opaque colours are therefore identical to their ARGB8888 pixel value.
+// Arithmetic works on pairs of channels at once (red and blue, alpha and green) using integer multiplies.
+class PackedColour {
+public:
+	uint32_t value;
+
+	static PackedColour fromColour(const Colour &colour); // premultiplies
+	Colour toColour(void) const; // divides out alpha again (fully transparent colours give black)
+
+	uint8_t getR(void) const { return value>>16; }
+	uint8_t getG(void) const { return value>>8; }
+	uint8_t getB(void) const { return value; }
+	uint8_t getA(void) const { return value>>24; }
+	bool isOpaque(void) const { return value>=0xFF000000u; }
+
+	bool operator==(const PackedColour &other) const { return value==other.value; }
+	bool operator!=(const PackedColour &other) const { return value!=other.value; }
+
+	inline PackedColour scale(uint32_t factor) const; // factor is 8.8 fixed point (256 being 1.0), does not affect alpha, colour channels are capped at alpha
+	inline PackedColour blendOver(const PackedColour &dest) const; // 'over' operator, result is this colour drawn on top of dest
+};
+
+inline PackedColour PackedColour::scale(uint32_t factor) const {
+	PackedColour result;
+
+	// No channel can overflow if darkening, so scale red/blue and green at the same time (truncating, as for Colour::mul).
+	if (factor<=256) {
+		uint32_t rb=(((value&0x00FF00FFu)*factor)>>8)&0x00FF00FFu;
+		uint32_t g=(((value&0x0000FF00u)*factor)>>8)&0x0000FF00u;
+		result.value=(value&0xFF000000u)|rb|g;
+		return result;
+	}
+
+	uint32_t a=getA();
+	uint32_t r=(getR()*factor)>>8, g=(getG()*factor)>>8, b=(getB()*factor)>>8;
+	result.value=(a<<24)|((r<a ? r : a)<<16)|((g<a ? g : a)<<8)|(b<a ? b : a);
+	return result;
+}
+
+inline PackedColour PackedColour::blendOver(const PackedColour &dest) const {
+	// result=this+dest*(255-alpha)/255 for each channel, dividing by 255 with rounding (x+128+((x+128)>>8))>>8.
+	uint32_t inverseAlpha=255-getA();
+	uint32_t rb=(dest.value&0x00FF00FFu)*inverseAlpha+0x00800080u;
+	rb=((rb+((rb>>8)&0x00FF00FFu))>>8)&0x00FF00FFu;
+	uint32_t ag=((dest.value>>8)&0x00FF00FFu)*inverseAlpha+0x00800080u;
+	ag=(ag+((ag>>8)&0x00FF00FFu))&0xFF00FF00u;
+
+	PackedColour result;
+	result.value=value+(rb|ag); // cannot overflow as each channel of this is at most alpha
+	return result;
+}
+
 #endif
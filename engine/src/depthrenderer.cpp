@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <thread>
+
+#include "depthrenderer.h"
+#include "ray.h"
+#include "util.h"
+
+namespace TremorEngine {
+	struct DepthRendererCompareVisibleObjects {
+		bool operator() (const DepthRenderer::VisibleObject &i, const DepthRenderer::VisibleObject &j) {
+			return (i.distance<j.distance);
+		}
+	};
+
+	DepthRenderer::DepthRenderer(int width, Renderer::GetBlockInfoFunctor *getBlockInfoFunctor, void *getBlockInfoUserData, Renderer::GetObjectsInRangeFunctor *getObjectsInRangeFunctor, void *getObjectsInRangeUserData): width(width), getBlockInfoFunctor(getBlockInfoFunctor), getBlockInfoUserData(getBlockInfoUserData), getObjectsInRangeFunctor(getObjectsInRangeFunctor), getObjectsInRangeUserData(getObjectsInRangeUserData) {
+		assert(width>0);
+	}
+
+	DepthRenderer::~DepthRenderer() {
+	}
+
+	int DepthRenderer::getWidth(void) const {
+		return width;
+	}
+
+	void DepthRenderer::render(const Camera &camera, View &view) const {
+		double screenDist=camera.getScreenDistance(width);
+
+		// Trace ray for each column until it hits a block which cannot be seen past.
+		view.depths.resize(width);
+		for(int x=0; x<width; ++x) {
+			double rayDirX, rayDirY;
+			camera.getColumnDirection(x, width, &rayDirX, &rayDirY); // as Renderer::traceColumn
+			Ray ray(camera.getX(), camera.getY(), rayDirX, rayDirY);
+
+			view.depths[x]=camera.getMaxDist();
+			ray.next(); // advance ray to first intersection point
+			while(ray.getTrueDistance()<camera.getMaxDist()) {
+				Renderer::BlockInfo blockInfo;
+				if (getBlockInfoFunctor(ray.getMapX(), ray.getMapY(), &blockInfo, getBlockInfoUserData) && isBlockOccluding(blockInfo, camera)) {
+					view.depths[x]=ray.getTrueDistance();
+					break;
+				}
+				ray.next();
+			}
+		}
+
+		// Find objects which are in front of the depth in at least one column they cover.
+		view.objects.clear();
+		double forwardX=camera.getDirX();
+		double forwardY=camera.getDirY();
+		std::vector<Object *> *objects=getObjectsInRangeFunctor(camera, getObjectsInRangeUserData);
+		for(auto object : *objects) {
+			// Skip objects behind camera (see Renderer::collectFrameSprites).
+			double dx=camera.getX()-object->getCamera().getX();
+			double dy=camera.getY()-object->getCamera().getY();
+			double forwardDot=dx*forwardX+dy*forwardY;
+			if (forwardDot>=0.0)
+				continue;
+			double distance=sqrt(dx*dx+dy*dy);
+
+			// Compute range of columns the object covers (as for Renderer sprites, but with widths in map units as there is no unit block height).
+			int centreX=(dy*forwardX-dx*forwardY)/forwardDot*screenDist+width/2;
+			int halfW=(distance>0.0 ? std::min(0.5*object->getWidth()*screenDist/distance, (double)width) : width);
+			int leftX=std::max(centreX-halfW, 0), rightX=std::min(centreX+halfW, width-1);
+
+			VisibleObject visible;
+			visible.object=object;
+			visible.distance=distance;
+			visible.leftX=width;
+			visible.rightX=-1;
+			for(int x=leftX; x<=rightX; ++x)
+				if (distance<=view.depths[x]) {
+					visible.leftX=std::min(visible.leftX, x);
+					visible.rightX=x;
+				}
+			if (visible.rightX>=0)
+				view.objects.push_back(visible);
+		}
+		delete objects;
+
+		std::sort(view.objects.begin(), view.objects.end(), DepthRendererCompareVisibleObjects());
+	}
+
+	void DepthRenderer::renderBatch(const Camera *cameras, View *views, size_t count, unsigned threadCount) const {
+		if (threadCount==0)
+			threadCount=std::max(std::thread::hardware_concurrency(), 1u);
+		threadCount=std::min(threadCount, (unsigned)count);
+
+		// Each thread repeatedly takes the next camera not yet started, so uneven costs balance out.
+		std::atomic<size_t> next(0);
+		auto work=[&]() {
+			size_t i;
+			while((i=next++)<count)
+				render(cameras[i], views[i]);
+		};
+
+		std::vector<std::thread> threads;
+		for(unsigned i=1; i<threadCount; ++i)
+			threads.push_back(std::thread(work));
+		work(); // use calling thread too
+		for(auto &thread : threads)
+			thread.join();
+	}
+
+	bool DepthRenderer::isBlockOccluding(const Renderer::BlockInfo &blockInfo, const Camera &camera) const {
+		// Cannot see over block?
+		if (blockInfo.height<camera.getZ())
+			return false;
+
+		// Cannot see through block?
+		return (blockInfo.texture==NULL || blockInfo.texture->getTransparency()==Texture::Transparency::None);
+	}
+};
@@ -0,0 +1,49 @@
+#ifndef TREMORENGINE_DEPTHRENDERER_H
+#define TREMORENGINE_DEPTHRENDERER_H
+
+#include <vector>
+
+#include "camera.h"
+#include "object.h"
+#include "renderer.h"
+
+namespace TremorEngine {
+
+	// Depth-only 'rendering' for answering what a camera can see, without any colours or SDL calls (so can be used by a server with a Map loaded without an SDL renderer).
+	// Each screen column gives the distance along its ray to the first block which blocks the view at the camera's height, and objects in front of this in any column are reported as visible.
+	// Rendering does not modify the DepthRenderer, so views for many cameras can be computed in parallel (provided the functors are safe to call from multiple threads, as the Map ones are).
+	class DepthRenderer {
+	public:
+		struct VisibleObject {
+			Object *object;
+			double distance;
+			int leftX, rightX; // range of columns (inclusive) in which the object is not hidden behind a block
+		};
+
+		struct View {
+			std::vector<double> depths; // one entry per column, camera's max distance if nothing hit
+			std::vector<VisibleObject> objects; // nearest first
+		};
+
+		DepthRenderer(int width, Renderer::GetBlockInfoFunctor *getBlockInfoFunctor, void *getBlockInfoUserData, Renderer::GetObjectsInRangeFunctor *getObjectsInRangeFunctor, void *getObjectsInRangeUserData); // width is the number of columns
+		~DepthRenderer();
+
+		int getWidth(void) const;
+
+		void render(const Camera &camera, View &view) const;
+		void renderBatch(const Camera *cameras, View *views, size_t count, unsigned threadCount=0) const; // renders views[i] for cameras[i] using up to threadCount threads (0 meaning one per hardware thread)
+
+	private:
+		int width;
+
+		Renderer::GetBlockInfoFunctor *getBlockInfoFunctor;
+		void *getBlockInfoUserData;
+		Renderer::GetObjectsInRangeFunctor *getObjectsInRangeFunctor;
+		void *getObjectsInRangeUserData;
+
+		bool isBlockOccluding(const Renderer::BlockInfo &blockInfo, const Camera &camera) const; // true if the block cannot be seen past or over from the camera's height
+	};
+
+};
+
+#endif
@@ -7,10 +7,13 @@
 
 #include "camera.h"
 #include "colour.h"
+#include "depthrenderer.h"
 #include "map.h"
 #include "object.h"
+#include "palette.h"
 #include "ray.h"
 #include "renderer.h"
+#include "spritecache.h"
 #include "texture.h"
 #include "udppacket.h"
 #include "util.h"
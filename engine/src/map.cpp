@@ -1,10 +1,15 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <libgen.h>
 
 #include "map.h"
+#include "ray.h"
 #include "util.h"
 
 namespace TremorEngine {
@@ -13,6 +18,11 @@ namespace TremorEngine {
 		return map->getBlockInfoFunctor(mapX, mapY, info);
 	}
 
+	bool mapGetFloorInfoFunctor(int mapX, int mapY, Renderer::FloorInfo *info, void *userData) {
+		class Map *map=(class Map *)userData;
+		return map->getFloorInfoFunctor(mapX, mapY, info);
+	}
+
 	std::vector<Object *> *mapGetObjectsInRangeFunctor(const Camera &camera, void *userData) {
 		class Map *map=(class Map *)userData;
 		return map->getObjectsInRangeFunctor(camera);
@@ -25,7 +35,15 @@ namespace TremorEngine {
 		file=(char *)malloc(1); // TODO: think about this
 		file[0]='\0';
 		name=std::string("Unnamed Map");
-		blocks=NULL;
+		blockOccupancy=NULL;
+		blockHeights=NULL;
+		blockColours=NULL;
+		blockTextures=NULL;
+		blockHeightMax=0;
+		floorTextures=NULL;
+		ceilingTextures=NULL;
+		ambientLight=0.25;
+		blockLightmaps=NULL;
 		colourGround.r=0;
 		colourGround.g=255;
 		colourGround.b=0;
@@ -34,24 +52,21 @@ namespace TremorEngine {
 		colourSky.g=0;
 		colourSky.b=255;
 		colourSky.a=255;
+		skyTexture=NULL;
 		brightnessMin=0.0;
 		brightnessMax=0.0;
 
 		// Allocate textures vector
 		textures=new std::vector<Texture *>;
+		palette=NULL;
 
 		// Allocate objects vector
 		objects=new std::vector<Object *>;
 
-		// Allocate blocks array
-		blocks=(Block *)malloc(sizeof(Block)*width*height);
-		if (blocks==NULL)
+		// Allocate blocks arrays (initially all empty)
+		if (!allocateBlocks())
 			return;
 
-		// Fill blocks array with height=0 to imply empty
-		for(unsigned i=0; i<width*height; ++i)
-			blocks[i].height=0.0;
-
 		// Done
 		hasInit=true;
 	}
@@ -61,6 +76,7 @@ namespace TremorEngine {
 
 		// Allocate textures vector
 		textures=new std::vector<Texture *>;
+		palette=NULL;
 
 		// Allocate objects vector
 		objects=new std::vector<Object *>;
@@ -74,7 +90,15 @@ namespace TremorEngine {
 		name=std::string("Unnamed Map");
 		width=0;
 		height=0;
-		blocks=NULL;
+		blockOccupancy=NULL;
+		blockHeights=NULL;
+		blockColours=NULL;
+		blockTextures=NULL;
+		blockHeightMax=0;
+		floorTextures=NULL;
+		ceilingTextures=NULL;
+		ambientLight=0.25;
+		blockLightmaps=NULL;
 		colourGround.r=0;
 		colourGround.g=255;
 		colourGround.b=0;
@@ -83,6 +107,7 @@ namespace TremorEngine {
 		colourSky.g=0;
 		colourSky.b=255;
 		colourSky.a=255;
+		skyTexture=NULL;
 		brightnessMin=0.0;
 		brightnessMax=0.0;
 
@@ -104,16 +129,12 @@ namespace TremorEngine {
 			return;
 		}
 
-		// Allocate blocks array and fill with height=0 to imply empty
-		blocks=(Block *)malloc(sizeof(Block)*width*height);
-		if (blocks==NULL) {
-			std::cout << "Could not load map: could not allocate blocks array." << std::endl;
+		// Allocate blocks arrays (initially all empty)
+		if (!allocateBlocks()) {
+			std::cout << "Could not load map: could not allocate blocks arrays." << std::endl;
 			return;
 		}
 
-		for(unsigned i=0; i<width*height; ++i)
-			blocks[i].height=0.0;
-
 		// Parse JSON data - load textures
 		if (renderer!=NULL && jsonMap.count("textures")==1 && jsonMap["textures"].is_array())
 			for(auto &entry : jsonMap["textures"].items()) {
@@ -122,6 +143,18 @@ namespace TremorEngine {
 					std::cout << "Warning while loading map: bad texture '" << jsonTexture << "'." << std::endl;
 			}
 
+		// Quantize textures if requested
+		if (jsonMap.count("quantizeTextures")==1 && jsonMap["quantizeTextures"].is_boolean() && jsonMap["quantizeTextures"].get<bool>())
+			if (!quantizeTextures())
+				std::cout << "Warning while loading map: could not quantize textures." << std::endl;
+
+		// Parse JSON data - sky texture (now that textures are loaded)
+		if (jsonMap.count("skyTexture")==1 && jsonMap["skyTexture"].is_number()) {
+			skyTexture=getTextureById(jsonMap["skyTexture"].get<int>());
+			if (skyTexture==NULL)
+				std::cout << "Warning while loading map: bad sky texture '" << jsonMap["skyTexture"] << "'." << std::endl;
+		}
+
 		// Parse JSON data - load blocks
 		if (jsonMap.count("blocks")==1 && jsonMap["blocks"].is_array()) {
 			for(auto &entry : jsonMap["blocks"].items()) {
@@ -131,6 +164,28 @@ namespace TremorEngine {
 			}
 		}
 
+		// Parse JSON data - load floors
+		if (jsonMap.count("floors")==1 && jsonMap["floors"].is_array()) {
+			for(auto &entry : jsonMap["floors"].items()) {
+				json jsonFloor=entry.value();
+				if (!jsonParseFloor(jsonFloor))
+					std::cout << "Warning while loading map: bad floor '" << jsonFloor << "'." << std::endl;
+			}
+		}
+
+		// Parse JSON data - load lights, and then bake lightmaps (now that all blocks are loaded)
+		if (jsonMap.count("ambientLight")==1 && jsonMap["ambientLight"].is_number())
+			ambientLight=jsonMap["ambientLight"].get<double>();
+		if (jsonMap.count("lights")==1 && jsonMap["lights"].is_array()) {
+			for(auto &entry : jsonMap["lights"].items()) {
+				json jsonLight=entry.value();
+				if (!jsonParseLight(jsonLight))
+					std::cout << "Warning while loading map: bad light '" << jsonLight << "'." << std::endl;
+			}
+		}
+		if (!lights.empty() && !bakeLightmaps())
+			std::cout << "Warning while loading map: could not bake lightmaps." << std::endl;
+
 		// Parse JSON data - load objects
 		if (jsonMap.count("objects")==1 && jsonMap["objects"].is_array()) {
 			for(auto &entry : jsonMap["objects"].items()) {
@@ -145,8 +200,8 @@ namespace TremorEngine {
 	}
 
 	Map::~Map() {
-		// Free blocks array
-		free(blocks);
+		// Free blocks arrays
+		freeBlocks();
 
 		// Free objects vector
 		// TODO: delete all entries also?
@@ -156,6 +211,9 @@ namespace TremorEngine {
 		// TODO: delete all entries also?
 		delete textures;
 
+		// Free palette
+		delete palette;
+
 		// Free file
 		free(file);
 	}
@@ -165,21 +223,34 @@ namespace TremorEngine {
 		if (mapX<0 || mapX>=width || mapY<0 || mapY>=height)
 			return false;
 
-		// Grab block data
-		const Block *block=&blocks[mapX+width*mapY];
-
 		// Empty block?
-		if (block->height==0.0)
+		// Note: we check this before touching any of the other blocks arrays.
+		int index=mapX+width*mapY;
+		if (!getBlockOccupied(index))
 			return false;
 
 		// Fill block info struct
-		info->height=block->height;
-		info->colour=block->colour;
-		info->texture=getTextureById(block->textureId);
+		info->height=((double)blockHeights[index])/blockHeightScale;
+		info->colour=blockColours[index];
+		info->texture=blockTextures[index];
+		info->lightmap=(blockLightmaps!=NULL ? blockLightmaps+index*Renderer::lightmapSize : NULL);
 
 		return true;
 	}
 
+	bool Map::getFloorInfoFunctor(int mapX, int mapY, Renderer::FloorInfo *info) {
+		// Outside of map region?
+		if (mapX<0 || mapX>=width || mapY<0 || mapY>=height)
+			return false;
+
+		// Fill floor info struct
+		int index=mapX+width*mapY;
+		info->floorTexture=floorTextures[index];
+		info->ceilingTexture=ceilingTextures[index];
+
+		return (info->floorTexture!=NULL || info->ceilingTexture!=NULL);
+	}
+
 	std::vector<Object *> *Map::getObjectsInRangeFunctor(const Camera &camera) {
 		std::vector<Object *> *list=new std::vector<Object *>;
 
@@ -224,6 +295,10 @@ namespace TremorEngine {
 		return colourSky;
 	}
 
+	Texture *Map::getSkyTexture(void) const {
+		return skyTexture;
+	}
+
 	double Map::getBrightnessMin(void) const {
 		return brightnessMin;
 	}
@@ -232,6 +307,14 @@ namespace TremorEngine {
 		return brightnessMax;
 	}
 
+	double Map::getBlockHeightMax(void) const {
+		return ((double)blockHeightMax)/blockHeightScale;
+	}
+
+	const Palette *Map::getPalette(void) const {
+		return palette;
+	}
+
 	bool Map::addTexture(int id, const char *path) {
 		// No renderer provided in constructor?
 		if (renderer==NULL)
@@ -257,6 +340,177 @@ namespace TremorEngine {
 		return true;
 	}
 
+	bool Map::quantizeTextures(void) {
+		// Generate palette
+		if (palette==NULL)
+			palette=new Palette();
+		palette->generate(*textures);
+
+		// Quantize each texture
+		bool result=true;
+		for(auto texture : *textures)
+			if (texture!=NULL && !texture->quantize(palette))
+				result=false;
+
+		return result;
+	}
+
+	double Map::getAmbientLight(void) const {
+		return ambientLight;
+	}
+
+	void Map::setAmbientLight(double value) {
+		assert(value>=0.0);
+
+		ambientLight=value;
+	}
+
+	void Map::addLight(const Light &light) {
+		lights.push_back(light);
+	}
+
+	bool Map::bakeLightmaps(void) {
+		free(blockLightmaps);
+		blockLightmaps=NULL;
+
+		if (lights.empty())
+			return true;
+
+		size_t count=((size_t)width)*height;
+		blockLightmaps=(uint8_t *)malloc(Renderer::lightmapSize*count);
+		if (blockLightmaps==NULL)
+			return false;
+
+		for(size_t index=0; index<count; ++index) {
+			if (!getBlockOccupied(index))
+				continue;
+
+			// Note: map coordinates are offset by one (see Ray::getMapX), so the block covers [mapX-1,mapX)x[mapY-1,mapY).
+			double cellX=((int)(index%width))-1.0;
+			double cellY=((int)(index/width))-1.0;
+			double blockHeight=((double)blockHeights[index])/blockHeightScale;
+			uint8_t *lightmap=blockLightmaps+index*Renderer::lightmapSize;
+
+			// Walls have a light level for each column, sampled at the centre of the column.
+			for(int column=0; column<Renderer::lightmapColumns; ++column) {
+				double offset=(column+0.5)/Renderer::lightmapColumns;
+				lightmap[((int)Renderer::BlockFace::MinX)*Renderer::lightmapColumns+column]=computeLightLevel(cellX, cellY+offset, blockHeight, -1.0, 0.0, 0.0);
+				lightmap[((int)Renderer::BlockFace::MaxX)*Renderer::lightmapColumns+column]=computeLightLevel(cellX+1.0, cellY+offset, blockHeight, 1.0, 0.0, 0.0);
+				lightmap[((int)Renderer::BlockFace::MinY)*Renderer::lightmapColumns+column]=computeLightLevel(cellX+offset, cellY, blockHeight, 0.0, -1.0, 0.0);
+				lightmap[((int)Renderer::BlockFace::MaxY)*Renderer::lightmapColumns+column]=computeLightLevel(cellX+offset, cellY+1.0, blockHeight, 0.0, 1.0, 0.0);
+			}
+
+			// Top just has a single light level, sampled at its centre.
+			lightmap[((int)Renderer::BlockFace::Top)*Renderer::lightmapColumns]=computeLightLevel(cellX+0.5, cellY+0.5, blockHeight, 0.0, 0.0, 1.0);
+		}
+
+		return true;
+	}
+
+	bool Map::allocateBlocks(void) {
+		size_t count=((size_t)width)*height;
+
+		// Allocate arrays
+		blockOccupancy=(uint64_t *)malloc(sizeof(uint64_t)*((count+63)/64));
+		blockHeights=(uint16_t *)malloc(sizeof(uint16_t)*count);
+		blockColours=(Colour *)malloc(sizeof(Colour)*count);
+		blockTextures=(Texture **)malloc(sizeof(Texture *)*count);
+		floorTextures=(Texture **)malloc(sizeof(Texture *)*count);
+		ceilingTextures=(Texture **)malloc(sizeof(Texture *)*count);
+		if (blockOccupancy==NULL || blockHeights==NULL || blockColours==NULL || blockTextures==NULL || floorTextures==NULL || ceilingTextures==NULL) {
+			freeBlocks();
+			return false;
+		}
+
+		// Clear occupancy bitset to imply all cells are empty
+		memset(blockOccupancy, 0, sizeof(uint64_t)*((count+63)/64));
+		blockHeightMax=0;
+
+		// No floors or ceilings initially either
+		for(size_t i=0; i<count; ++i) {
+			floorTextures[i]=NULL;
+			ceilingTextures[i]=NULL;
+		}
+
+		return true;
+	}
+
+	void Map::freeBlocks(void) {
+		free(blockOccupancy);
+		blockOccupancy=NULL;
+		free(blockHeights);
+		blockHeights=NULL;
+		free(blockColours);
+		blockColours=NULL;
+		free(blockTextures);
+		blockTextures=NULL;
+		free(floorTextures);
+		floorTextures=NULL;
+		free(ceilingTextures);
+		ceilingTextures=NULL;
+		free(blockLightmaps);
+		blockLightmaps=NULL;
+	}
+
+	bool Map::getBlockOccupied(int index) const {
+		return (blockOccupancy[index/64]>>(index%64))&1;
+	}
+
+	uint8_t Map::computeLightLevel(double x, double y, double z, double normalX, double normalY, double normalZ) const {
+		// For walls z is the height of the block - as a single level covers the whole column, each light is treated as hitting the point on the column nearest to it.
+		bool isWall=(normalZ==0.0);
+
+		double level=ambientLight;
+		for(auto &light : lights) {
+			double pointZ=(isWall ? std::max(0.0, std::min(light.z, z)) : z);
+			double dx=light.x-x, dy=light.y-y, dz=light.z-pointZ;
+			double distance=sqrt(dx*dx+dy*dy+dz*dz);
+			if (distance>=light.radius)
+				continue;
+
+			// Light behind face?
+			double cosine=(distance>0.0 ? (dx*normalX+dy*normalY+dz*normalZ)/distance : 1.0);
+			if (cosine<=0.0)
+				continue;
+
+			// Start just off the face, so the line does not begin inside the block itself.
+			const double epsilon=1e-6;
+			if (!getLightVisible(light, x+normalX*epsilon, y+normalY*epsilon, pointZ+normalZ*epsilon))
+				continue;
+
+			level+=light.intensity*(1.0-distance/light.radius)*cosine;
+		}
+
+		return clamp((int)floor(level*255+0.5), 0, 255);
+	}
+
+	bool Map::getLightVisible(const Light &light, double x, double y, double z) const {
+		// Step through each cell the line passes through, checking whether the line is below the top of any block in it at either the point it enters or leaves (the lowest point within the cell, as the line is straight).
+		double dx=light.x-x, dy=light.y-y;
+		double lineLength=sqrt(dx*dx+dy*dy);
+		Ray ray(x, y, angleNormalise(atan2(dy, dx)));
+		double distance=0.0;
+		while(1) {
+			int mapX=ray.getMapX(), mapY=ray.getMapY();
+
+			// Find where the line leaves this cell (or reaches the light, if sooner).
+			ray.next();
+			double exitDistance=std::min(ray.getTrueDistance(), lineLength);
+
+			if (mapX>=0 && mapX<width && mapY>=0 && mapY<height && getBlockOccupied(mapX+mapY*width)) {
+				double entryZ=(lineLength>0.0 ? z+(light.z-z)*(distance/lineLength) : light.z);
+				double exitZ=(lineLength>0.0 ? z+(light.z-z)*(exitDistance/lineLength) : light.z);
+				if (((double)blockHeights[mapX+mapY*width])/blockHeightScale>std::min(entryZ, exitZ))
+					return false;
+			}
+
+			// Reached the light? (with some tolerance for a light exactly on the edge of a block)
+			if (exitDistance>=lineLength-1e-9)
+				return true;
+			distance=exitDistance;
+		}
+	}
+
 	bool Map::jsonParseMetadata(const json &mapObject) {
 		// Check map object type.
 		if (!mapObject.is_object())
@@ -336,22 +590,85 @@ namespace TremorEngine {
 		if (blockX<0 || blockX>=width || blockY<0 || blockY>=height || blockHeight<=0.0)
 			return false;
 
+		// Quantize height - rounding to nearest but ensuring we never round down to an empty block, or overflow
+		double blockHeightMaxAllowed=((double)UINT16_MAX)/blockHeightScale;
+		if (blockHeight>blockHeightMaxAllowed) {
+			std::cout << "Warning while loading map: block at (" << blockX << "," << blockY << ") has height " << blockHeight << " above the maximum of " << blockHeightMaxAllowed << ", clamping." << std::endl;
+			blockHeight=blockHeightMaxAllowed;
+		}
+		int blockHeightFixed=floor(blockHeight*blockHeightScale+0.5);
+		blockHeightFixed=clamp(blockHeightFixed, 1, UINT16_MAX);
+
 		Colour blockColour;
 		if (blockObject.count("colour")!=1 || !jsonParseColour(blockObject["colour"], blockColour))
 			return false;
 
-		int textureId=-1;
-		if (blockObject.count("texture")==1 && blockObject["texture"].is_number()) {
-			textureId=blockObject["texture"].get<int>(); // TODO: check id points to valid texture
-			if (textureId<0)
-				textureId=-1;
-		}
+		// Resolve texture now to save doing so on every lookup (textures are always loaded before blocks)
+		Texture *blockTexture=NULL;
+		if (blockObject.count("texture")==1 && blockObject["texture"].is_number())
+			blockTexture=getTextureById(blockObject["texture"].get<int>()); // NULL if bad id
+
+		// Update blocks arrays
+		int index=blockX+blockY*width;
+		blockOccupancy[index/64]|=(((uint64_t)1)<<(index%64));
+		blockHeights[index]=blockHeightFixed;
+		blockColours[index]=blockColour;
+		blockTextures[index]=blockTexture;
+		blockHeightMax=std::max(blockHeightMax, (uint16_t)blockHeightFixed);
+
+		return true;
+	}
+
+	bool Map::jsonParseFloor(const json &floorObject) {
+		// Check object is well formed
+		if (!floorObject.is_object())
+			return false;
+
+		if (floorObject.count("x")!=1 || !floorObject["x"].is_number() ||
+		    floorObject.count("y")!=1 || !floorObject["y"].is_number())
+			return false;
+
+		int floorX=floorObject["x"].get<int>();
+		int floorY=floorObject["y"].get<int>();
+		if (floorX<0 || floorX>=width || floorY<0 || floorY>=height)
+			return false;
+
+		// Resolve textures (either may be omitted)
+		Texture *floorTexture=NULL;
+		if (floorObject.count("floorTexture")==1 && floorObject["floorTexture"].is_number())
+			floorTexture=getTextureById(floorObject["floorTexture"].get<int>()); // NULL if bad id
+		Texture *ceilingTexture=NULL;
+		if (floorObject.count("ceilingTexture")==1 && floorObject["ceilingTexture"].is_number())
+			ceilingTexture=getTextureById(floorObject["ceilingTexture"].get<int>()); // NULL if bad id
+
+		// Update floor arrays
+		int index=floorX+floorY*width;
+		floorTextures[index]=floorTexture;
+		ceilingTextures[index]=ceilingTexture;
+
+		return true;
+	}
+
+	bool Map::jsonParseLight(const json &lightObject) {
+		// Check object is well formed
+		if (!lightObject.is_object())
+			return false;
+
+		if (lightObject.count("x")!=1 || !lightObject["x"].is_number() ||
+		    lightObject.count("y")!=1 || !lightObject["y"].is_number())
+			return false;
+
+		// Grab light properties (all but position are optional)
+		Light light;
+		light.x=lightObject["x"].get<double>();
+		light.y=lightObject["y"].get<double>();
+		light.z=(lightObject.count("z")==1 && lightObject["z"].is_number() ? lightObject["z"].get<double>() : 0.5);
+		light.intensity=(lightObject.count("intensity")==1 && lightObject["intensity"].is_number() ? lightObject["intensity"].get<double>() : 1.0);
+		light.radius=(lightObject.count("radius")==1 && lightObject["radius"].is_number() ? lightObject["radius"].get<double>() : 8.0);
+		if (light.intensity<0.0 || light.radius<=0.0)
+			return false;
 
-		// Update blocks array
-		Block *block=&blocks[blockX+blockY*width];
-		block->height=blockHeight;
-		block->colour=blockColour;
-		block->textureId=textureId;
+		addLight(light);
 
 		return true;
 	}
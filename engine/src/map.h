@@ -1,6 +1,7 @@
 #ifndef TREMORENGINE_MAP_H
 #define TREMORENGINE_MAP_H
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -8,6 +9,7 @@
 #include "colour.h"
 #include "json.hpp"
 #include "object.h"
+#include "palette.h"
 #include "renderer.h"
 #include "texture.h"
 
@@ -16,16 +18,24 @@ using json=nlohmann::json;
 namespace TremorEngine {
 	// Wrapper functions suitable for passing to Renderer constructor (with class pointer as userData)
 	bool mapGetBlockInfoFunctor(int mapX, int mapY, Renderer::BlockInfo *info, void *userData);
+	bool mapGetFloorInfoFunctor(int mapX, int mapY, Renderer::FloorInfo *info, void *userData); // for Renderer::setFloorInfoFunctor
 	std::vector<Object *> *mapGetObjectsInRangeFunctor(const Camera &camera, void *userData);
 
 	class Map {
 	public:
+		struct Light {
+			double x, y, z; // z is a fraction of the unit block height (as for Camera)
+			double intensity; // light level added at the light's position (where 1.0 is fully lit), decreasing linearly to zero at radius
+			double radius;
+		};
+
 		// renderer can be NULL in constructor, but then textures will always fail to add
 		Map(SDL_Renderer *renderer, int width, int height);
 		Map(SDL_Renderer *renderer, const char *file);
 		~Map();
 
 		bool getBlockInfoFunctor(int mapX, int mapY, Renderer::BlockInfo *info);
+		bool getFloorInfoFunctor(int mapX, int mapY, Renderer::FloorInfo *info);
 		std::vector<Object *> *getObjectsInRangeFunctor(const Camera &camera);
 
 		bool getHasInit(void);
@@ -36,16 +46,24 @@ namespace TremorEngine {
 		int getHeight(void) const;
 		const Colour &getGroundColour(void) const;
 		const Colour &getSkyColour(void) const;
+		Texture *getSkyTexture(void) const; // NULL if none
 		double getBrightnessMin(void) const;
 		double getBrightnessMax(void) const;
+		double getBlockHeightMax(void) const; // height of tallest block, 0.0 if no blocks
+		const Palette *getPalette(void) const; // NULL unless textures have been quantized
 
 		bool addTexture(int id, const char *path);
+		bool quantizeTextures(void); // generates palette from all textures and then quantizes them to it (textures added later are not quantized)
+
+		// Static lighting - lights are baked into per block face lightmaps (see Renderer::BlockInfo), so cost nothing to render.
+		// Lightmaps are not updated automatically, so bakeLightmaps should be called once all lights (and blocks) have been added.
+		double getAmbientLight(void) const; // light level of faces not reached by any light, default 0.25
+		void setAmbientLight(double value);
+		void addLight(const Light &light);
+		bool bakeLightmaps(void); // returns false on failure - if there are no lights then any lightmaps are freed (so blocks are fully lit)
 	private:
-		struct Block {
-			double height; // if set to 0.0 then no block here
-			Colour colour;
-			int textureId; // set to -1 if no texture
-		};
+		static const int blockHeightScale=256; // block heights are stored as fixed point values with this many steps per unit block height
+		// So the tallest block is UINT16_MAX/blockHeightScale (just under 256) units high - taller blocks are clamped to this when loading (with a warning).
 
 		bool hasInit;
 
@@ -55,15 +73,41 @@ namespace TremorEngine {
 		std::string name;
 		int width, height;
 		Colour colourGround, colourSky;
+		Texture *skyTexture;
 		double brightnessMin, brightnessMax;
 
 		std::vector<Texture *> *textures;
-		Block *blocks;
+		Palette *palette;
 		std::vector<Object *> *objects;
 
+		// Blocks are stored as a structure of arrays, each with width*height entries (except the bitset).
+		// Ray traversal mostly visits empty cells, so only needs to touch the (small) occupancy bitset until it hits something.
+		uint64_t *blockOccupancy; // one bit per cell, set if there is a block present
+		uint16_t *blockHeights; // fixed point, see blockHeightScale - undefined if cell is empty
+		Colour *blockColours; // undefined if cell is empty
+		Texture **blockTextures; // pre-resolved from the block's texture id, NULL if no texture - undefined if cell is empty
+		uint16_t blockHeightMax; // fixed point, see blockHeightScale
+
+		// Floor and ceiling textures for each cell (regardless of whether it contains a block), NULL if none.
+		Texture **floorTextures;
+		Texture **ceilingTextures;
+
+		std::vector<Light> lights;
+		double ambientLight;
+		uint8_t *blockLightmaps; // NULL unless baked, otherwise Renderer::lightmapSize entries per cell - undefined if cell is empty
+
+		bool allocateBlocks(void); // allocates block arrays based on width and height, and marks all cells empty
+		void freeBlocks(void);
+		bool getBlockOccupied(int index) const;
+
+		uint8_t computeLightLevel(double x, double y, double z, double normalX, double normalY, double normalZ) const; // for a point on a block face with the given (unit) normal
+		bool getLightVisible(const Light &light, double x, double y, double z) const; // true if no blocks are in the way of the straight line from the point to the light
+
 		bool jsonParseMetadata(const json &mapObject);
 		bool jsonParseTexture(const json &textureObject);
 		bool jsonParseBlock(const json &blockObject);
+		bool jsonParseFloor(const json &floorObject);
+		bool jsonParseLight(const json &lightObject);
 		bool jsonParseObject(const json &objectObject);
 
 		bool jsonParseColour(const json &object, Colour &colour) const; // colour unchanged if fails
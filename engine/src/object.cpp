@@ -46,11 +46,13 @@ namespace TremorEngine {
 	}
 
 	Texture *Object::getTextureAngle(double angle) const {
-		// TODO: this seems convoluted and can no doubt be improved
-		double fraction=angleNormalise(angle)/(2.0*M_PI)-0.25;
-		if (fraction<0)
-			fraction+=1.0;
-		int n=floor(getTextureCount()*fraction+0.5); // +0.5 is to round to nearest rather than always down
+		return getTextureBinaryAngle(binaryAngleFromRadians(angle));
+	}
+
+	Texture *Object::getTextureBinaryAngle(BinaryAngle angle) const {
+		// Textures start at a quarter turn, and the angle is rounded to the nearest one (the wrap around of the subtraction does the normalising).
+		uint32_t fraction=(BinaryAngle)(angle-binaryAngleFullTurn/4);
+		int n=(fraction*getTextureCount()+binaryAngleFullTurn/2)/binaryAngleFullTurn;
 		if (n>=getTextureCount())
 			n-=getTextureCount();
 		return getTextureN(n);
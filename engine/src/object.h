@@ -52,6 +52,7 @@ namespace TremorEngine {
 		int getTextureCount(void) const ;
 		Texture *getTextureN(int n) const ;
 		Texture *getTextureAngle(double angle) const ;
+		Texture *getTextureBinaryAngle(BinaryAngle angle) const ;
 
 		void move(double delta); // Move in current direction (or backwards if delta is negative).
 		void strafe(double delta); // Move perpendicular to direction (left is delta is negative, right if positive).
@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include "palette.h"
+
+namespace TremorEngine {
+	struct PaletteHistogramEntry {
+		uint8_t channels[3]; // 5 bits each
+		uint32_t count;
+	};
+
+	struct PaletteCompareHistogramEntries {
+		PaletteCompareHistogramEntries(int channel): channel(channel) {
+		}
+
+		bool operator() (const PaletteHistogramEntry &i, const PaletteHistogramEntry &j) {
+			return (i.channels[channel]<j.channels[channel]);
+		}
+
+		int channel;
+	};
+
+	static uint8_t paletteExpandChannel(int value) {
+		// Expand 5 bit value to 8 bits, such that 0 and 31 map to 0 and 255.
+		return (value<<3)|(value>>2);
+	}
+
+	Palette::Palette(void) {
+		// Create 3-3-2 bit RGB palette
+		for(int i=0; i<size; ++i) {
+			colours[i].r=((i>>5)&7)*255/7;
+			colours[i].g=((i>>2)&7)*255/7;
+			colours[i].b=(i&3)*255/3;
+			colours[i].a=255;
+		}
+
+		computeNearestTable();
+	}
+
+	Palette::~Palette() {
+	}
+
+	void Palette::generate(const std::vector<Texture *> &textures) {
+		// Build histogram of (opaque) pixel colours, at 5 bits per channel.
+		std::vector<uint32_t> counts(1<<15, 0);
+		for(auto texture : textures) {
+			if (texture==NULL)
+				continue;
+
+			const PackedColour *pixels=texture->getPixels();
+			int count=texture->getWidth()*texture->getHeight();
+			for(int i=0; i<count; ++i)
+				if (pixels[i].getA()>0) {
+					Colour colour=pixels[i].toColour();
+					++counts[((colour.r>>3)<<10)|((colour.g>>3)<<5)|(colour.b>>3)];
+				}
+		}
+
+		std::vector<PaletteHistogramEntry> entries;
+		for(int i=0; i<(1<<15); ++i)
+			if (counts[i]>0) {
+				PaletteHistogramEntry entry;
+				entry.channels[0]=(i>>10)&31;
+				entry.channels[1]=(i>>5)&31;
+				entry.channels[2]=i&31;
+				entry.count=counts[i];
+				entries.push_back(entry);
+			}
+
+		// Median cut - repeatedly split the box (range of entries) with the largest extent along any channel, at the median along that channel.
+		std::vector<std::pair<size_t, size_t> > boxes;
+		if (!entries.empty())
+			boxes.push_back(std::make_pair((size_t)0, entries.size()));
+		while(boxes.size()<(size_t)size) {
+			// Find box with largest extent.
+			int bestBox=-1, bestChannel=0, bestExtent=0;
+			for(size_t i=0; i<boxes.size(); ++i)
+				for(int channel=0; channel<3; ++channel) {
+					int min=31, max=0;
+					for(size_t j=boxes[i].first; j<boxes[i].second; ++j) {
+						min=std::min(min, (int)entries[j].channels[channel]);
+						max=std::max(max, (int)entries[j].channels[channel]);
+					}
+					if (max-min>bestExtent) {
+						bestBox=i;
+						bestChannel=channel;
+						bestExtent=max-min;
+					}
+				}
+
+			// No box can be split further? (i.e. fewer distinct colours than palette entries)
+			if (bestBox<0)
+				break;
+
+			// Sort entries in box along channel and split where half of the pixels are either side (but never leaving either side empty).
+			size_t start=boxes[bestBox].first, end=boxes[bestBox].second;
+			std::sort(entries.begin()+start, entries.begin()+end, PaletteCompareHistogramEntries(bestChannel));
+
+			uint64_t total=0;
+			for(size_t j=start; j<end; ++j)
+				total+=entries[j].count;
+			uint64_t sum=0;
+			size_t split=start+1;
+			for(size_t j=start; j<end-1; ++j) {
+				sum+=entries[j].count;
+				split=j+1;
+				if (2*sum>=total)
+					break;
+			}
+
+			boxes[bestBox].second=split;
+			boxes.push_back(std::make_pair(split, end));
+		}
+
+		// Each box gives one palette entry - the (weighted) average of its colours.
+		for(int i=0; i<size; ++i) {
+			colours[i].r=colours[i].g=colours[i].b=0;
+			colours[i].a=255;
+			if (i>=(int)boxes.size())
+				continue;
+
+			uint64_t sums[3]={0, 0, 0}, total=0;
+			for(size_t j=boxes[i].first; j<boxes[i].second; ++j) {
+				for(int channel=0; channel<3; ++channel)
+					sums[channel]+=paletteExpandChannel(entries[j].channels[channel])*(uint64_t)entries[j].count;
+				total+=entries[j].count;
+			}
+			colours[i].r=(sums[0]+total/2)/total;
+			colours[i].g=(sums[1]+total/2)/total;
+			colours[i].b=(sums[2]+total/2)/total;
+		}
+
+		computeNearestTable();
+	}
+
+	const Colour &Palette::getColour(int index) const {
+		assert(index>=0 && index<size);
+
+		return colours[index];
+	}
+
+	uint8_t Palette::getNearestIndex(const Colour &colour) const {
+		return nearestTable[((colour.r>>3)<<10)|((colour.g>>3)<<5)|(colour.b>>3)];
+	}
+
+	uint8_t Palette::getNearestIndex(const PackedColour &colour) const {
+		return nearestTable[((colour.getR()>>3)<<10)|((colour.getG()>>3)<<5)|(colour.getB()>>3)];
+	}
+
+	void Palette::computeNearestTable(void) {
+		for(int i=0; i<(1<<15); ++i) {
+			int r=paletteExpandChannel((i>>10)&31);
+			int g=paletteExpandChannel((i>>5)&31);
+			int b=paletteExpandChannel(i&31);
+
+			int bestIndex=0, bestDistance=std::numeric_limits<int>::max();
+			for(int j=0; j<size; ++j) {
+				int dr=r-colours[j].r, dg=g-colours[j].g, db=b-colours[j].b;
+				int distance=dr*dr+dg*dg+db*db;
+				if (distance<bestDistance) {
+					bestIndex=j;
+					bestDistance=distance;
+				}
+			}
+
+			nearestTable[i]=bestIndex;
+		}
+	}
+};
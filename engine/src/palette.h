@@ -0,0 +1,35 @@
+#ifndef TREMORENGINE_PALETTE_H
+#define TREMORENGINE_PALETTE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "colour.h"
+#include "texture.h"
+
+namespace TremorEngine {
+
+	class Palette {
+	public:
+		static const int size=256;
+
+		Palette(void); // initially a simple 3-3-2 bit RGB palette
+		~Palette();
+
+		void generate(const std::vector<Texture *> &textures); // replaces colours with those best representing the given textures' (opaque) pixels, NULL entries are ignored
+
+		const Colour &getColour(int index) const;
+		uint8_t getNearestIndex(const Colour &colour) const; // alpha is ignored
+		uint8_t getNearestIndex(const PackedColour &colour) const; // alpha is ignored (i.e. colour should be opaque, or already blended onto something which is)
+
+	private:
+		Colour colours[size];
+
+		uint8_t nearestTable[1<<15]; // nearest palette index for each colour, indexed by top 5 bits of each of r, g and b
+
+		void computeNearestTable(void);
+	};
+
+};
+
+#endif
@@ -6,15 +6,18 @@
 
 namespace TremorEngine {
 
-	Ray::Ray(double x, double y, double angle) {
+	Ray::Ray(double x, double y, double angle): Ray(x, y, cos(angle), sin(angle)) {
+	}
+
+	Ray::Ray(double x, double y, double dirX, double dirY) {
 		startX=x;
 		startY=y;
 
 		mapX=floor(startX);
 		mapY=floor(startY);
 
-		rayDirX=cos(angle);
-		rayDirY=sin(angle);
+		rayDirX=dirX;
+		rayDirY=dirY;
 
 		deltaDistX=(rayDirX!=0.0 ? fabs(1.0/rayDirX) : std::numeric_limits<double>::max());
 		deltaDistY=(rayDirY!=0.0 ? fabs(1.0/rayDirY) : std::numeric_limits<double>::max());
@@ -56,6 +59,21 @@ namespace TremorEngine {
 		updateTrueDistance();
 	}
 
+	void Ray::skipTo(int gMapX, int gMapY, Side gSide) {
+		assert(gSide!=Side::None);
+
+		// Note: map coordinates we expose are offset by one from those used internally.
+		mapX=gMapX-1;
+		mapY=gMapY-1;
+		side=gSide;
+
+		// Recompute distances to next x and y sides from this cell (as in constructor).
+		sideDistX=(stepX<0 ? (startX-mapX)*deltaDistX : (mapX+1-startX)*deltaDistX);
+		sideDistY=(stepY<0 ? (startY-mapY)*deltaDistY : (mapY+1-startY)*deltaDistY);
+
+		updateTrueDistance();
+	}
+
 	int Ray::getMapX(void) const {
 		return mapX+1;
 	}
@@ -72,7 +90,15 @@ namespace TremorEngine {
 		return side;
 	}
 
-	int Ray::getTextureX(int textureW) const {
+	int Ray::getStepX(void) const {
+		return stepX;
+	}
+
+	int Ray::getStepY(void) const {
+		return stepY;
+	}
+
+	double Ray::getWallOffset(void) const {
 		double intersectionX;
 		switch(side) {
 			case Side::Vertical:
@@ -82,10 +108,17 @@ namespace TremorEngine {
 				intersectionX=startX+getTrueDistance()*rayDirX;
 			break;
 			case Side::None:
-				return 0; // we have not yet hit a wall
+				return 0.0; // we have not yet hit a wall
 			break;
 		}
-		intersectionX-=floor((intersectionX));
+		return intersectionX-floor(intersectionX);
+	}
+
+	int Ray::getTextureX(int textureW) const {
+		if (side==Side::None)
+			return 0; // we have not yet hit a wall
+
+		double intersectionX=getWallOffset();
 
 		int textureX=textureW-((int)floor(intersectionX*textureW))-1;
 		if (side==Side::Vertical && rayDirX>0)
@@ -1,19 +1,23 @@
 #ifndef TREMORENGINE_RAY_H
 #define TREMORENGINE_RAY_H
 
+#include <cstdint>
+
 namespace TremorEngine {
 
 	class Ray {
 	public:
-		enum class Side {
+		enum class Side : uint8_t {
 			Vertical,
 			Horizontal,
 			None, // next() has not yet been called on the ray and so we have not hit any walls
 		};
 		Ray(double x, double y, double angle); // 0<=angle<2pi, in radians.
+		Ray(double x, double y, double dirX, double dirY); // direction should be a unit vector (e.g. from Camera::getColumnDirection)
 		~Ray();
 
 		void next(void); // Advance to next intersection point.
+		void skipTo(int mapX, int mapY, Side side); // Jump straight to the intersection where the ray enters the given cell via the given side, as if next() had been called enough times. The caller must know the ray actually passes through this cell this way (e.g. from tracing a neighbouring ray along the same path).
 
 		int getMapX(void) const ;
 		int getMapY(void) const ;
@@ -22,6 +26,10 @@ namespace TremorEngine {
 
 		Side getSide(void) const ; // Type of of last intersection
 
+		int getStepX(void) const ; // Direction ray moves in when crossing a vertical side (either +1 or -1).
+		int getStepY(void) const ; // Direction ray moves in when crossing a horizontal side (either +1 or -1).
+
+		double getWallOffset(void) const; // return, as of last intersection, the position along the wall in interval [0,1) - increasing with y for vertical sides, and with x for horizontal ones
 		int getTextureX(int textureW) const; // return, as of last intersection, the x-offset into a texture rendered on this wall
 	private:
 		double startX, startY;
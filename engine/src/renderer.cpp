@@ -1,49 +1,152 @@
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include <SDL2/SDL2_gfxPrimitives.h>
 
 #include "ray.h"
 #include "renderer.h"
+#include "util.h"
 
 namespace TremorEngine {
-	struct RendererCompareObjectsByDistance {
-		RendererCompareObjectsByDistance(const Camera &camera): camera(camera) {
+	struct RendererCompareFrameDynamicLights {
+		template<typename T> bool operator() (const T &i, const T &j) {
+			return (i.key<j.key);
 		}
+	};
 
-		~RendererCompareObjectsByDistance() {
-		}
+	template<typename T> static void rendererSortByKey(std::vector<T> &items, std::vector<T> &scratch) {
+		// Radix sort on 32 bit keys, a byte at a time - each pass is stable, so items with equal keys keep their original order.
+		scratch.resize(items.size());
+		for(int shift=0; shift<32; shift+=8) {
+			size_t counts[256]={0};
+			for(const auto &item : items)
+				++counts[(item.key>>shift)&255];
+
+			// Skip pass if every key has the same byte here.
+			if (items.empty() || counts[(items[0].key>>shift)&255]==items.size())
+				continue;
 
-		bool operator() (Object *i, Object *j) {
-			double iDx=i->getCamera().getX()-camera.getX();
-			double iDy=i->getCamera().getY()-camera.getY();
-			double iDist2=(iDx*iDx+iDy*iDy);
+			size_t offset=0;
+			for(int i=0; i<256; ++i) {
+				size_t count=counts[i];
+				counts[i]=offset;
+				offset+=count;
+			}
+			for(const auto &item : items)
+				scratch[counts[(item.key>>shift)&255]++]=item;
+			items.swap(scratch);
+		}
+	}
 
-			double jDx=j->getCamera().getX()-camera.getX();
-			double jDy=j->getCamera().getY()-camera.getY();
-			double jDist2=(jDx*jDx+jDy*jDy);
+	static bool rendererColourEqual(const Colour &a, const Colour &b) {
+		return (a.r==b.r && a.g==b.g && a.b==b.b && a.a==b.a);
+	}
 
-			return (iDist2>=jDist2);
+	static uint32_t rendererHeatPixel(double value) {
+		// Maps value in [0,1] (clamped) through blue, cyan, green, yellow and red, in SDL_PIXELFORMAT_ARGB8888 format with full alpha.
+		value=std::max(0.0, std::min(value, 1.0))*4.0;
+		int segment=std::min((int)value, 3);
+		int ramp=(value-segment)*255;
+		uint32_t r=0, g=0, b=0;
+		switch(segment) {
+			case 0: g=ramp; b=255; break;
+			case 1: g=255; b=255-ramp; break;
+			case 2: r=ramp; g=255; break;
+			case 3: r=255; g=255-ramp; break;
 		}
+		return 0xFF000000u|(r<<16)|(g<<8)|b;
+	}
 
-		const Camera &camera;
-	};
+	static uint32_t rendererColourToPixel(const Colour &colour, uint8_t alpha) {
+		// Converts to SDL_PIXELFORMAT_ARGB8888 format
+		return (((uint32_t)alpha)<<24)|(((uint32_t)colour.r)<<16)|(((uint32_t)colour.g)<<8)|colour.b;
+	}
+
+	static uint32_t rendererPackedColourToPixel(const PackedColour &colour) {
+		// Converts to SDL_PIXELFORMAT_ARGB8888 format, forcing full opacity (as for rendererColourToPixel with alpha 255)
+		return (colour.isOpaque() ? colour.value : rendererColourToPixel(colour.toColour(), 255));
+	}
 
-	Renderer::Renderer(SDL_Renderer *renderer, int windowWidth, int windowHeight, double unitBlockHeight, GetBlockInfoFunctor *getBlockInfoFunctor, void *getBlockInfoUserData, GetObjectsInRangeFunctor *getObjectsInRangeFunctor, void *getObjectsInRangeUserData): renderer(renderer), windowWidth(windowWidth), windowHeight(windowHeight), unitBlockHeight(unitBlockHeight), getBlockInfoFunctor(getBlockInfoFunctor), getBlockInfoUserData(getBlockInfoUserData), getObjectsInRangeFunctor(getObjectsInRangeFunctor), getObjectsInRangeUserData(getObjectsInRangeUserData) {
+	Renderer::Renderer(SDL_Renderer *renderer, int windowWidth, int windowHeight, double unitBlockHeight, GetBlockInfoFunctor *getBlockInfoFunctor, void *getBlockInfoUserData, GetObjectsInRangeFunctor *getObjectsInRangeFunctor, void *getObjectsInRangeUserData): renderer(renderer), windowWidth(windowWidth), windowHeight(windowHeight), windowUnitBlockHeight(unitBlockHeight), getBlockInfoFunctor(getBlockInfoFunctor), getBlockInfoUserData(getBlockInfoUserData), getObjectsInRangeFunctor(getObjectsInRangeFunctor), getObjectsInRangeUserData(getObjectsInRangeUserData) {
 		colourBg.r=255; colourBg.g=0; colourBg.b=255; colourBg.a=255; // Pink (to help identify any undrawn regions).
 		colourGround.r=0; colourGround.g=255; colourGround.b=0; colourGround.a=255; // Green.
 		colourSky.r=0; colourSky.g=0; colourSky.b=255; colourSky.a=255; // Blue.
+		skyTexture=NULL;
+
+		palette=NULL;
+		colourMapsDirty=true;
 
-		zBuffer=(double *)malloc(sizeof(double)*windowWidth*windowHeight);
+		dynamicLightBudget=8;
+
+		getFloorInfoFunctor=NULL;
+		getFloorInfoUserData=NULL;
+		floorTimeBudget=0;
+		floorTimeAverage=0.0;
+		floorTimeFallbackFramesLeft=0;
+		backgroundTexture=NULL;
+		backgroundGradientTexture=NULL;
 
 		brightnessMin=0.0;
 		brightnessMax=1.0;
+
+		blockHeightMax=std::numeric_limits<double>::infinity();
+
+		columnInterpolationStride=1;
+		temporalColumnReuse=false;
+		traces.cameraX=prevTraces.cameraX=0.0;
+		traces.cameraY=prevTraces.cameraY=0.0;
+		traces.cameraMaxDist=prevTraces.cameraMaxDist=0.0;
+
+		frameTimeTarget=0;
+		frameTimeMinScale=0.5;
+		frameTimeAverage=0.0;
+		frameTimeSettleFrames=0;
+
+		viewParent=NULL;
+
+		indexedFramebuffer=false;
+		indexedTexture=NULL;
+		pipelineFrameReady=false;
+
+		debugView=DebugView::None;
+		debugTexture=NULL;
+
+		topDownTexture=NULL;
+		topDownDirty=true;
+		topDownMinMapX=topDownMinMapY=topDownMaxMapX=topDownMaxMapY=0;
+
+		// Initially render at the window's size.
+		zBuffer=NULL;
+		renderTexture=NULL;
+		resizeRender(windowWidth, windowHeight);
 	}
 
 	Renderer::~Renderer() {
+		for(auto view : viewRenderers)
+			delete view;
+
 		free(zBuffer);
+
+		if (renderTexture!=NULL)
+			SDL_DestroyTexture(renderTexture);
+
+		if (backgroundTexture!=NULL)
+			SDL_DestroyTexture(backgroundTexture);
+		if (backgroundGradientTexture!=NULL)
+			SDL_DestroyTexture(backgroundGradientTexture);
+		if (topDownTexture!=NULL)
+			SDL_DestroyTexture(topDownTexture);
+		if (debugTexture!=NULL)
+			SDL_DestroyTexture(debugTexture);
+		if (indexedTexture!=NULL)
+			SDL_DestroyTexture(indexedTexture);
 	}
 
 	double Renderer::getBrightnessMin(void) const {
@@ -58,297 +161,605 @@ namespace TremorEngine {
 		assert(value>=0.0 && value<=1.0);
 
 		brightnessMin=value;
+		backgroundGradientDirty=true;
+		colourMapsDirty=true;
 	}
 
 	void Renderer::setBrightnessMax(double value) {
 		assert(value>=0.0 && value<=1.0);
 
 		brightnessMax=value;
+		backgroundGradientDirty=true;
+		colourMapsDirty=true;
+	}
+
+	double Renderer::getBlockHeightMax(void) const {
+		return blockHeightMax;
+	}
+
+	void Renderer::setBlockHeightMax(double value) {
+		assert(value>=0.0);
+
+		blockHeightMax=value;
 	}
 
 	void Renderer::setGroundColour(const Colour &colour) {
 		colourGround=colour;
+		backgroundGradientDirty=true;
 	}
 
 	void Renderer::setSkyColour(const Colour &colour) {
 		colourSky=colour;
+		backgroundGradientDirty=true;
+	}
+
+	Texture *Renderer::getSkyTexture(void) const {
+		return skyTexture;
+	}
+
+	void Renderer::setSkyTexture(Texture *texture) {
+		skyTexture=texture;
+	}
+
+	void Renderer::setFloorInfoFunctor(GetFloorInfoFunctor *functor, void *userData) {
+		getFloorInfoFunctor=functor;
+		getFloorInfoUserData=userData;
+	}
+
+	MicroSeconds Renderer::getFloorTimeBudget(void) const {
+		return floorTimeBudget;
+	}
+
+	void Renderer::setFloorTimeBudget(MicroSeconds budget) {
+		assert(budget>=0);
+
+		floorTimeBudget=budget;
+		floorTimeAverage=0.0;
+		floorTimeFallbackFramesLeft=0;
+	}
+
+	const Palette *Renderer::getPalette(void) const {
+		return palette;
+	}
+
+	void Renderer::setPalette(const Palette *value) {
+		palette=value;
+		colourMapsDirty=true;
+		pipelineFrameReady=false; // waiting frame's indices are for the old palette
+	}
+
+	bool Renderer::getIndexedFramebuffer(void) const {
+		return indexedFramebuffer;
+	}
+
+	void Renderer::setIndexedFramebuffer(bool value) {
+		indexedFramebuffer=value;
+		pipelineFrameReady=false;
+	}
+
+	size_t Renderer::getSpriteCacheBudget(void) const {
+		return spriteCache.getBudget();
+	}
+
+	void Renderer::setSpriteCacheBudget(size_t bytes) {
+		spriteCache.setBudget(bytes);
+	}
+
+	void Renderer::clearSpriteCache(void) {
+		spriteCache.clear();
+	}
+
+	Renderer::DebugView Renderer::getDebugView(void) const {
+		return debugView;
+	}
+
+	void Renderer::setDebugView(DebugView value) {
+		debugView=value;
+	}
+
+	void Renderer::clearDynamicLights(void) {
+		dynamicLights.clear();
+	}
+
+	void Renderer::addDynamicLight(const DynamicLight &light) {
+		assert(light.radius>0.0);
+
+		dynamicLights.push_back(light);
+	}
+
+	int Renderer::getDynamicLightBudget(void) const {
+		return dynamicLightBudget;
+	}
+
+	void Renderer::setDynamicLightBudget(int value) {
+		assert(value>=0 && value<=dynamicLightBudgetMax);
+
+		dynamicLightBudget=value;
+	}
+
+	int Renderer::getColumnInterpolationStride(void) const {
+		return columnInterpolationStride;
+	}
+
+	void Renderer::setColumnInterpolationStride(int value) {
+		assert(value>=1);
+
+		columnInterpolationStride=value;
+	}
+
+	bool Renderer::getTemporalColumnReuse(void) const {
+		return temporalColumnReuse;
+	}
+
+	void Renderer::setTemporalColumnReuse(bool value) {
+		temporalColumnReuse=value;
+	}
+
+	double Renderer::getRenderScaleX(void) const {
+		return ((double)renderWidth)/windowWidth;
+	}
+
+	double Renderer::getRenderScaleY(void) const {
+		return ((double)renderHeight)/windowHeight;
+	}
+
+	bool Renderer::setRenderScale(double scaleX, double scaleY) {
+		assert(scaleX>0.0 && scaleX<=1.0);
+		assert(scaleY>0.0 && scaleY<=1.0);
+
+		int width=std::max((int)floor(windowWidth*scaleX+0.5), 1);
+		int height=std::max((int)floor(windowHeight*scaleY+0.5), 1);
+		if (width==renderWidth && height==renderHeight)
+			return true;
+
+		return resizeRender(width, height);
+	}
+
+	MicroSeconds Renderer::getFrameTimeTarget(void) const {
+		return frameTimeTarget;
+	}
+
+	void Renderer::setFrameTimeTarget(MicroSeconds target, double minScale) {
+		assert(target>=0);
+		assert(minScale>0.0 && minScale<=1.0);
+
+		frameTimeTarget=target;
+		frameTimeMinScale=minScale;
+		frameTimeAverage=0.0;
+		frameTimeSettleFrames=0;
+	}
+
+	void Renderer::invalidateBlock(int mapX, int mapY) {
+		if (mapX>=topDownMinMapX && mapX<=topDownMaxMapX && mapY>=topDownMinMapY && mapY<=topDownMaxMapY)
+			topDownDirty=true;
+
+		for(auto view : viewRenderers)
+			if (view!=NULL)
+				view->invalidateBlock(mapX, mapY);
+
+		// The most recent frame's results are those which may be reused, so discard any columns whose ray may have passed through this cell.
+		// These are exactly those within the angle covered by the cell, as seen from the rays' origin.
+		// Note: map coordinates are offset by one (see Ray::getMapX).
+		double cellX=mapX-1;
+		double cellY=mapY-1;
+		double originX=traces.cameraX;
+		double originY=traces.cameraY;
+
+		// If the origin is in (or on the edge of) the cell then every ray is affected.
+		if (originX>=cellX && originX<=cellX+1.0 && originY>=cellY && originY<=cellY+1.0) {
+			for(auto &column : traces.columns)
+				column.ready=false;
+			return;
+		}
+
+		// Find range of angles covered by the cell, relative to the angle to its centre (which avoids issues with wrapping).
+		double centreAngle=atan2(cellY+0.5-originY, cellX+0.5-originX);
+		double minDeltaAngle=0.0, maxDeltaAngle=0.0;
+		for(int i=0; i<4; ++i) {
+			double cornerX=cellX+(i&1);
+			double cornerY=cellY+(i>>1);
+			double deltaAngle=angleNormalise(atan2(cornerY-originY, cornerX-originX)-centreAngle+M_PI)-M_PI;
+			minDeltaAngle=std::min(minDeltaAngle, deltaAngle);
+			maxDeltaAngle=std::max(maxDeltaAngle, deltaAngle);
+		}
+
+		// Invalidate any columns in this range (with some tolerance for rays passing exactly through a corner).
+		const double epsilon=1e-9;
+		for(auto &column : traces.columns) {
+			double deltaAngle=angleNormalise(column.angle-centreAngle+M_PI)-M_PI;
+			if (deltaAngle>=minDeltaAngle-epsilon && deltaAngle<=maxDeltaAngle+epsilon)
+				column.ready=false;
+		}
 	}
 
 	void Renderer::render(const Camera &camera, bool drawZBuffer) {
-		// Calculate various useful values.
-		double screenDist=camera.getScreenDistance(windowWidth);
+		MicroSeconds frameStartTime=microSecondsGet();
 
-		int cameraZScreenAdjustment=(camera.getZ()-0.5)*unitBlockHeight;
+		pipelineFrameReady=false; // any frame waiting from renderPipelined is now out of date
 
-		double cameraPitchScreenAdjustmentDouble=tan(camera.getPitch())*screenDist;
-		if (cameraPitchScreenAdjustmentDouble>windowHeight)
-			cameraPitchScreenAdjustmentDouble=windowHeight;
-		if (cameraPitchScreenAdjustmentDouble<-windowHeight)
-			cameraPitchScreenAdjustmentDouble=-windowHeight;
-		int cameraPitchScreenAdjustment=cameraPitchScreenAdjustmentDouble;
+		std::vector<Object *> *objects=getObjectsInRangeFunctor(camera, getObjectsInRangeUserData);
 
-		int horizonHeight=windowHeight/2+cameraPitchScreenAdjustment;
+		FrameParameters params;
+		prepareFrame(camera, *objects, params);
+		drawFrame(params, drawZBuffer);
 
-		// Clear z-buffer to infinity values.
-		for(unsigned i=0; i<windowWidth*windowHeight; ++i)
-			zBuffer[i]=std::numeric_limits<double>::max();
+		delete objects;
 
-		// Clear surface.
-		SDL_SetRenderDrawColor(renderer, colourBg.r, colourBg.g, colourBg.b, colourBg.a);
-		SDL_Rect rect={0, 0, windowWidth, windowHeight};
-		SDL_RenderFillRect(renderer, &rect);
+		updateFrameTime(microSecondsGet()-frameStartTime);
+	}
 
-		// Draw sky and ground.
-		int y;
-		for(y=0;y<windowHeight;++y) {
-			Colour colour;
+	void Renderer::renderViews(const View *views, size_t count, bool drawZBuffer) {
+		if (count==0)
+			return;
 
-			if (y<horizonHeight) {
-				// Calculate distance in order to adjust colour.
-				double distance=unitBlockHeight/(2*(horizonHeight-y));
+		MicroSeconds frameStartTime=microSecondsGet();
 
-				// Sky
-				colour=colourSky;
-				colourAdjustForDistance(colour, distance);
-				SDL_SetRenderDrawColor(renderer, colour.r, colour.g, colour.b, colour.a);
-				SDL_RenderDrawLine(renderer, 0, y, windowWidth, y);
-			} else {
-				// Calculate distance in order to adjust colour.
-				double distance=unitBlockHeight/(2*(y-horizonHeight));
-
-				// Ground
-				colour=colourGround;
-				colourAdjustForDistance(colour, distance);
-				SDL_SetRenderDrawColor(renderer, colour.r, colour.g, colour.b, colour.a);
-				SDL_RenderDrawLine(renderer, 0, y, windowWidth, y);
+		// Create or resize a renderer for each view as needed, and bring its settings in line with ours.
+		updateColourMaps();
+		for(size_t i=0; i<count; ++i) {
+			assert(views[i].camera!=NULL);
+			assert(views[i].viewport.w>0 && views[i].viewport.h>0);
+
+			if (i>=viewRenderers.size())
+				viewRenderers.push_back(NULL);
+			Renderer *&view=viewRenderers[i];
+			if (view!=NULL && (view->windowWidth!=views[i].viewport.w || view->windowHeight!=views[i].viewport.h)) {
+				delete view;
+				view=NULL;
 			}
+			if (view==NULL) {
+				// Keep the same unit block height relative to the height drawn at, so blocks keep their proportions.
+				view=new Renderer(renderer, views[i].viewport.w, views[i].viewport.h, windowUnitBlockHeight*views[i].viewport.h/windowHeight, getBlockInfoFunctor, getBlockInfoUserData, getObjectsInRangeFunctor, getObjectsInRangeUserData);
+				view->viewParent=this;
+			}
+			updateViewRenderer(view);
 		}
 
-		// Draw blocks.
-		// Loop over each vertical slice of the screen.
-		int x;
-		for(x=0;x<windowWidth;++x) {
-			// Trace ray from view point at this angle to collect a list of 'slices' of blocks to later draw.
-			double deltaAngle=atan((x-windowWidth/2)/screenDist);
-			double angle=camera.getYaw()+deltaAngle;
-			Ray ray(camera.getX(), camera.getY(), angle);
-
-			#define SlicesMax 64
-			BlockDisplaySlice slices[SlicesMax];
-			size_t slicesNext=0;
-
-			ray.next(); // advance ray to first intersection point
-			while(ray.getTrueDistance()<camera.getMaxDist()) {
-				// Get info for block at current ray position.
-				int mapX=ray.getMapX();
-				int mapY=ray.getMapY();
-				if (!getBlockInfoFunctor(mapX, mapY, &slices[slicesNext].blockInfo, getBlockInfoUserData)) {
-					ray.next(); // advance ray here as we skip proper advancing futher in loop body
-					continue; // no block
-				}
+		// Objects are queried once for all views.
+		std::vector<Object *> *objects=getObjectsInRangeFunctor(*views[0].camera, getObjectsInRangeUserData);
+
+		// Trace each view's rays in parallel (this only touches the view's own state, and does not call SDL).
+		std::vector<FrameParameters> params(count);
+		std::atomic<size_t> next(0);
+		auto work=[&]() {
+			size_t i;
+			while((i=next++)<count)
+				viewRenderers[i]->prepareFrame(*views[i].camera, *objects, params[i]);
+		};
+
+		unsigned threadCount=std::min((unsigned)count, std::max(std::thread::hardware_concurrency(), 1u));
+		std::vector<std::thread> threads;
+		for(unsigned i=1; i<threadCount; ++i)
+			threads.push_back(std::thread(work));
+		work(); // use calling thread too
+		for(auto &thread : threads)
+			thread.join();
+
+		// Draw each view into its region of the window in turn.
+		SDL_Rect windowViewport;
+		SDL_RenderGetViewport(renderer, &windowViewport);
+		for(size_t i=0; i<count; ++i) {
+			SDL_RenderSetViewport(renderer, &views[i].viewport);
+			viewRenderers[i]->drawFrame(params[i], drawZBuffer);
+		}
+		SDL_RenderSetViewport(renderer, &windowViewport);
 
-				// We have already added blockInfo to slice stack, so add and compute other fields now.
-				slices[slicesNext].distance=ray.getTrueDistance();
-				slices[slicesNext].intersectionSide=ray.getSide();
-				slices[slicesNext].blockDisplayBase=computeBlockDisplayBase(slices[slicesNext].distance, cameraZScreenAdjustment, cameraPitchScreenAdjustment);
-				slices[slicesNext].blockDisplayHeight=computeBlockDisplayHeight(slices[slicesNext].blockInfo.height, slices[slicesNext].distance);
-				if (slices[slicesNext].blockInfo.texture!=NULL) {
-					int textureW=slices[slicesNext].blockInfo.texture->getWidth();
-					slices[slicesNext].blockTextureX=ray.getTextureX(textureW);
-				}
+		delete objects;
 
-				// If this block occupies whole column already, no point searching further.
-				// FIXME: this logic will break if we end up supporting mapping textures with transparency onto blocks
-				if (slices[slicesNext].blockDisplayHeight==slices[slicesNext].blockDisplayBase) {
-					++slicesNext;
-					break;
-				}
+		updateFrameTime(microSecondsGet()-frameStartTime);
+	}
 
-				// Advance ray to next itersection now ready for next iteration, and for use in block top calculations.
-				ray.next();
-
-				// If top of block is visible, compute some extra stuff.
-				int blockDisplayTop=slices[slicesNext].blockDisplayBase-slices[slicesNext].blockDisplayHeight;
-				if (blockDisplayTop>horizonHeight) {
-					double nextDistance=ray.getTrueDistance();
-					int nextBlockDisplayBase=computeBlockDisplayBase(nextDistance, cameraZScreenAdjustment, cameraPitchScreenAdjustment);
-					int nextBlockDisplayHeight=computeBlockDisplayHeight(slices[slicesNext].blockInfo.height, nextDistance);
-					int nextBlockDisplayTop=nextBlockDisplayBase-nextBlockDisplayHeight;
-					slices[slicesNext].blockDisplayTopSize=blockDisplayTop-nextBlockDisplayTop;
-				}
+	void Renderer::renderPipelined(const Camera &camera) {
+		if (!isIndexed() || debugView!=DebugView::None) {
+			render(camera, false);
+			return;
+		}
 
-				// Push slice to stack
-				++slicesNext;
-			}
+		MicroSeconds frameStartTime=microSecondsGet();
 
-			// Loop over found blocks in reverse
-			while(slicesNext>0) {
-				// Adjust slicesNext now due to how it usually points one beyond last entry
-				--slicesNext;
+		// Do anything which needs SDL (or the caller's state to be left alone) before starting the other thread.
+		std::vector<Object *> *objects=getObjectsInRangeFunctor(camera, getObjectsInRangeUserData);
+		if (!updateBackgroundGradient()) {
+			// Without the gradient drawScene would try again from the other thread, so just render normally instead.
+			delete objects;
+			render(camera, false);
+			return;
+		}
 
-				// Draw block
-				if (!drawZBuffer) {
-					if (slices[slicesNext].blockInfo.texture!=NULL) {
-						// Textured block
-						// Note: we always ask the renderer to draw the whole slice - even if say we are very close to a block and so most of the slice is not visible anyway - hoping that it interally optimises the blit.
-
-						uint8_t colourMod=255;
-						if (slices[slicesNext].intersectionSide==Ray::Side::Horizontal)
-							colourMod*=0.6;
-						colourMod*=colourDistanceFactor(slices[slicesNext].distance);
-						SDL_SetTextureColorMod(slices[slicesNext].blockInfo.texture->getSdlTexture(), colourMod, colourMod, colourMod); // make edges/corners between horizontal and vertical walls clearer
-
-						SDL_Rect srcRect={.x=slices[slicesNext].blockTextureX, .y=0, .w=1, .h=slices[slicesNext].blockInfo.texture->getHeight()};
-						SDL_Rect destRect={.x=x, .y=slices[slicesNext].blockDisplayBase-slices[slicesNext].blockDisplayHeight, .w=1, .h=slices[slicesNext].blockDisplayHeight};
-						SDL_RenderCopy(renderer, slices[slicesNext].blockInfo.texture->getSdlTexture(), &srcRect, &destRect);
-					} else {
-						// Solid colour block
-
-						// Calculate display colour for block
-						Colour blockDisplayColour=slices[slicesNext].blockInfo.colour;
-						if (slices[slicesNext].intersectionSide==Ray::Side::Horizontal)
-							blockDisplayColour.mul(0.6); // make edges/corners between horizontal and vertical walls clearer
-						colourAdjustForDistance(blockDisplayColour, slices[slicesNext].distance);
-
-						// Draw block
-						SDL_SetRenderDrawColor(renderer, blockDisplayColour.r, blockDisplayColour.g, blockDisplayColour.b, blockDisplayColour.a);
-						SDL_RenderDrawLine(renderer, x, slices[slicesNext].blockDisplayBase-slices[slicesNext].blockDisplayHeight, x, slices[slicesNext].blockDisplayBase);
-					}
-				}
+		// Render new frame into indexedPixels, while on this thread (which SDL must be used from) the previous frame is expanded, uploaded and drawn.
+		// If there is no previous frame then draw the new one once it is complete instead.
+		FrameParameters params;
+		auto work=[&]() {
+			prepareFrame(camera, *objects, params);
+			drawScene(params, false);
+		};
+		if (pipelineFrameReady) {
+			std::thread worker(work);
+			presentIndexedFramebuffer(&pipelinePixels[0]);
+			worker.join();
+		} else {
+			work();
+			presentIndexedFramebuffer(&indexedPixels[0]);
+		}
 
-				// Update z-buffer
-				int zBufferYLoopStart=slices[slicesNext].blockDisplayBase-slices[slicesNext].blockDisplayHeight;
-				if (zBufferYLoopStart<0)
-					zBufferYLoopStart=0;
-				int zBufferYLoopEnd=slices[slicesNext].blockDisplayBase;
-				if (zBufferYLoopEnd>=windowHeight)
-					zBufferYLoopEnd=windowHeight-1;
-				for(int y=zBufferYLoopStart; y<=zBufferYLoopEnd; ++y) {
-					assert(slices[slicesNext].distance<zBuffer[x+y*windowWidth]);
-					zBuffer[x+y*windowWidth]=slices[slicesNext].distance;
-				}
+		// New frame now waits to be drawn by the next call, and the old one's buffer is reused for the next render.
+		indexedPixels.swap(pipelinePixels);
+		pipelineFrameReady=true;
 
-				// Do we need to draw top of this block? (because it is below the horizon)
-				int blockDisplayTop=slices[slicesNext].blockDisplayBase-slices[slicesNext].blockDisplayHeight;
-				if (blockDisplayTop>horizonHeight) {
-					if (!drawZBuffer) {
-						Colour blockTopDisplayColour=slices[slicesNext].blockInfo.colour;
-						blockTopDisplayColour.mul(1.05);
-						colourAdjustForDistance(blockTopDisplayColour, slices[slicesNext].distance); // Note: distance is not quite correct - see note below when updating z-buffer
-						SDL_SetRenderDrawColor(renderer, blockTopDisplayColour.r, blockTopDisplayColour.g, blockTopDisplayColour.b, blockTopDisplayColour.a);
-						SDL_RenderDrawLine(renderer, x, blockDisplayTop-slices[slicesNext].blockDisplayTopSize, x, blockDisplayTop);
-					}
+		delete objects;
 
-					// Update z-buffer
-					int zBufferYLoopStart=blockDisplayTop-slices[slicesNext].blockDisplayTopSize;
-					if (zBufferYLoopStart<0)
-						zBufferYLoopStart=0;
-					int zBufferYLoopEnd=blockDisplayTop;
-					if (zBufferYLoopEnd>=windowHeight)
-						zBufferYLoopEnd=windowHeight-1;
-					for(int y=zBufferYLoopStart; y<=zBufferYLoopEnd; ++y) {
-						// Note: this is not correct - the distance should start at the one used below,
-						// but then increase up to the ray's distance at next intersection point,
-						// as calculated in ray casting step. However this should be safe for the purposes
-						// of using the z-buffer for drawing sprites, which should be above the floor/tops
-						// anyway.
-						zBuffer[x+y*windowWidth]=slices[slicesNext].distance;
-					}
-				}
+		updateFrameTime(microSecondsGet()-frameStartTime);
+	}
+
+	void Renderer::prepareFrame(const Camera &camera, const std::vector<Object *> &objects, FrameParameters &params) {
+		// Calculate various useful values.
+		params.camera=&camera;
+		params.screenDist=camera.getScreenDistance(renderWidth);
+
+		params.cameraZScreenAdjustment=(camera.getZ()-0.5)*unitBlockHeight;
+
+		double cameraPitchScreenAdjustmentDouble=camera.getPitchScreenOffset(renderWidth)*renderScaleRatio; // screenDist is based on the width, so adjust for any difference in vertical scale
+		if (cameraPitchScreenAdjustmentDouble>renderHeight)
+			cameraPitchScreenAdjustmentDouble=renderHeight;
+		if (cameraPitchScreenAdjustmentDouble<-renderHeight)
+			cameraPitchScreenAdjustmentDouble=-renderHeight;
+		params.cameraPitchScreenAdjustment=cameraPitchScreenAdjustmentDouble;
+
+		params.horizonHeight=renderHeight/2+params.cameraPitchScreenAdjustment;
+
+		// Ensure shading tables are up to date.
+		updateColourMaps();
+
+		// Clear z-buffer to infinity values.
+		for(unsigned i=0; i<renderWidth*renderHeight; ++i)
+			zBuffer[i]=std::numeric_limits<double>::max();
+
+		// Trace rays for each column to collect lists of 'slices' of blocks to draw.
+		traceColumns(params);
+
+		// Decide which dynamic lights may affect each part of the screen.
+		binDynamicLights(params);
+
+		// Decide which objects to draw, and in what order.
+		collectFrameSprites(params, objects);
+	}
+
+	void Renderer::drawFrame(const FrameParameters &params, bool drawZBuffer) {
+		// If rendering at a reduced size then draw to a texture instead, which is scaled up to fill the window (or viewport) at the end.
+		bool renderScaled=(renderWidth!=windowWidth || renderHeight!=windowHeight) && !isIndexed(); // indexed framebuffer is scaled up when presented anyway
+		SDL_Texture *windowTarget=NULL;
+		SDL_Rect windowViewport;
+		if (renderScaled) {
+			if (renderTexture==NULL) {
+				renderTexture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, renderWidth, renderHeight);
+				if (renderTexture==NULL)
+					return;
+				SDL_SetTextureBlendMode(renderTexture, SDL_BLENDMODE_NONE);
 			}
+			windowTarget=SDL_GetRenderTarget(renderer);
+			SDL_RenderGetViewport(renderer, &windowViewport);
+			SDL_SetRenderTarget(renderer, renderTexture);
+		}
 
-			#undef SlicesMax
+		drawScene(params, drawZBuffer);
+
+		if (isIndexed())
+			presentIndexedFramebuffer(&indexedPixels[0]);
+
+		// If needed draw z-buffer or debug view.
+		if (drawZBuffer || debugView!=DebugView::None)
+			drawDebugView(drawZBuffer);
+
+		// Scale up to fill the window if needed (changing target resets the viewport).
+		if (renderScaled) {
+			SDL_SetRenderTarget(renderer, windowTarget);
+			SDL_RenderSetViewport(renderer, &windowViewport);
+			SDL_RenderCopy(renderer, renderTexture, NULL, NULL);
 		}
+	}
 
-		// Draw object sprites
-		std::vector<Object *> *objects=getObjectsInRangeFunctor(camera, getObjectsInRangeUserData);
+	void Renderer::drawScene(const FrameParameters &params, bool drawZBuffer) {
+		int cameraZScreenAdjustment=params.cameraZScreenAdjustment;
+		int cameraPitchScreenAdjustment=params.cameraPitchScreenAdjustment;
 
-		RendererCompareObjectsByDistance compareObjectsByDistance(camera);
-		std::sort(objects->begin(), objects->end(), compareObjectsByDistance); // sort so that we paint closer objects over the top of further away ones (the z buffer is not enough if textures are partially transparent)
+		// Clear surface.
+		if (isIndexed())
+			memset(&indexedPixels[0], palette->getNearestIndex(colourBg), renderWidth*renderHeight);
+		else {
+			SDL_SetRenderDrawColor(renderer, colourBg.r, colourBg.g, colourBg.b, colourBg.a);
+			SDL_Rect rect={0, 0, renderWidth, renderHeight};
+			SDL_RenderFillRect(renderer, &rect);
+		}
 
-		for(auto object : *objects) {
-			// Determine angle (and distance) from camera to object, and skip drawing if object is behind camera.
-			double objectVisibleAngle, objectBearing, objectDistance;
-			camera.getTargetInfo(object->getCamera(), &objectVisibleAngle, &objectBearing, &objectDistance);
+		if (debugView==DebugView::Overdraw)
+			debugOverdraw.assign(renderWidth*renderHeight, 1); // background covers every pixel once
 
-			objectBearing=angleNormalise(objectBearing);
-			if (objectBearing<0.5*M_PI || objectBearing>1.5*M_PI)
-				continue;
+		// Draw sky and ground (timing this if textured floors are drawn, see setFloorTimeBudget).
+		bool floors=isDrawingFloors();
+		MicroSeconds backgroundStartTime=microSecondsGet();
+		drawBackground(params);
+		updateFloorTime(floors ? std::max(microSecondsGet()-backgroundStartTime, (MicroSeconds)1) : 0);
 
-			// Determine x-coordinate of screen where object should appear, and its width.
-			// Skip drawing if zero-width or off screen (too far left or right).
-			int objectCentreScreenX=tan(objectBearing)*screenDist+windowWidth/2;
-			int objectScreenW=computeBlockDisplayHeight(object->getWidth(), objectDistance);
-			if (objectScreenW<=0 || objectCentreScreenX+objectScreenW/2<0 || objectCentreScreenX-objectScreenW/2>=windowWidth)
-				continue;
+		// Draw blocks.
+		drawColumns(params, drawZBuffer);
+
+		// Draw object sprites
+		bool indexed=isIndexed();
+		for(const auto &sprite : frameSprites) {
+			Object *object=sprite.object;
+			double objectDistance=sprite.distance;
+			int objectCentreScreenX=sprite.centreScreenX;
+			int objectScreenW=sprite.screenW;
 
 			// Compute base and height of object on screen, and skip drawing if zero-height or off screen (too high/low).
 			int objectScreenBase=computeBlockDisplayBase(objectDistance, cameraZScreenAdjustment, cameraPitchScreenAdjustment);
 			int objectScreenH=computeBlockDisplayHeight(object->getHeight(), objectDistance);
-			if (objectScreenH<=0 || objectScreenBase<0 || objectScreenBase-objectScreenH>=windowHeight)
+			if (objectScreenH<=0 || objectScreenBase<0 || objectScreenBase-objectScreenH>=renderHeight)
 				continue;
 
-			// Grab texture info and compute factors used to map screen pixels to texture pixels.
-			Texture *objectTexture=object->getTextureAngle(objectVisibleAngle);
+			// Grab texture for the angle the object is seen from.
+			Texture *objectTexture=object->getTextureBinaryAngle(sprite.visibleAngle);
 			if (objectTexture==NULL)
 				continue;
 
-			double textureXFactor=((double)objectTexture->getWidth())/objectScreenW;
-			double textureYFactor=((double)objectTexture->getHeight())/objectScreenH;
+			// Add any dynamic lights (evaluated once for the whole sprite, at its centre).
+			int objectCentreScreenXClamped=std::max(0, std::min(objectCentreScreenX, renderWidth-1));
+			double objectLight=1.0+computeDynamicLight(objectCentreScreenXClamped, object->getCamera().getX(), object->getCamera().getY(), object->getCamera().getZ()+0.5*object->getHeight(), 0.0, 0.0, 0.0);
+
+			// Read from a copy of the texture pre-scaled to roughly the size drawn, if enabled and smaller than the texture itself.
+			SpriteCache::Image objectImage;
+			objectImage.width=objectTexture->getWidth();
+			objectImage.height=objectTexture->getHeight();
+			objectImage.pixels=objectTexture->getPixels();
+			objectImage.paletteIndices=objectTexture->getPaletteIndices();
+			SpriteCache &objectSpriteCache=(viewParent!=NULL ? viewParent->spriteCache : spriteCache); // views share their parent's
+			if (objectSpriteCache.getBudget()>0) {
+				int cacheWidth=SpriteCache::quantizeSize(objectScreenW, objectImage.width);
+				int cacheHeight=SpriteCache::quantizeSize(objectScreenH, objectImage.height);
+				if (cacheWidth<objectImage.width || cacheHeight<objectImage.height)
+					objectSpriteCache.getImage(objectTexture, cacheWidth, cacheHeight, &objectImage); // on failure image is left as the full texture
+			}
+
+			double textureXFactor=((double)objectImage.width)/objectScreenW;
+			double textureYFactor=((double)objectImage.height)/objectScreenH;
+
+			// If texture is quantized to our palette then shade using light level table (which only covers the usual range of levels, so cannot be used if lit - except when drawing indexed, where the table is chosen by the final shade).
+			double objectShade=colourDistanceFactor(objectDistance)*objectLight;
+			const uint8_t *objectTextureIndices=(palette!=NULL && objectTexture->getPalette()==palette && (objectLight==1.0 || indexed) ? objectImage.paletteIndices : NULL);
+			const uint32_t *objectColourMap=colourMaps[computeLightLevel(objectDistance)];
+			const uint8_t *objectShadeMap=indexedShadeMaps[computeIndexedShadeLevel(objectShade)];
+			uint32_t objectShadeFixed=objectShade*256; // for PackedColour::scale
 
 			// Loop over all pixels in the w/h region, deciding whether to paint each one.
 			// Loop over y values
 			for(int ty=0, sy=objectScreenBase-objectScreenH; ty<objectScreenH; ++ty, ++sy) {
 				// Column off screen?
-				if (sy<0 || sy>=windowHeight)
+				if (sy<0 || sy>=renderHeight)
 					continue;
 
 				// Loop over x values
 				int textureExtractY=ty*textureYFactor;
 				for(int tx=0, sx=objectCentreScreenX-objectScreenW/2; tx<objectScreenW; ++tx, ++sx) {
 					// Pixel off screen?
-					if (sx<0 || sx>=windowWidth)
+					if (sx<0 || sx>=renderWidth)
 						continue;
 
 					// z-buffer indicates object would not be visible?
-					if (objectDistance>zBuffer[sx+sy*windowWidth])
+					if (objectDistance>zBuffer[sx+sy*renderWidth])
 						continue;
 
 					// Grab pixel from texture and skip if completely transparent.
 					int textureExtractX=tx*textureXFactor;
-					Colour pixel=objectTexture->getPixel(textureExtractX, textureExtractY);
-					if (pixel.a==0)
+					PackedColour pixel=objectImage.pixels[textureExtractX+textureExtractY*objectImage.width];
+					if (pixel.getA()==0)
 						continue;
 
 					// Update z-buffer (no need if not drawing it - we already draw objects back-to-front anyway)
 					if (drawZBuffer)
-						zBuffer[sx+sy*windowWidth]=objectDistance;
+						zBuffer[sx+sy*renderWidth]=objectDistance;
 
 					// Draw pixel
-					if (!drawZBuffer) {
-						colourAdjustForDistance(pixel, objectDistance);
-						SDL_SetRenderDrawColor(renderer, pixel.r, pixel.g, pixel.b, pixel.a);
+					if (!drawZBuffer && indexed) {
+						uint8_t &destIndex=indexedPixels[sx+sy*renderWidth];
+						if (objectTextureIndices!=NULL && pixel.isOpaque())
+							destIndex=objectShadeMap[objectTextureIndices[textureExtractX+textureExtractY*objectImage.width]];
+						else {
+							// Partially transparent pixels are blended with the existing colour, then requantized.
+							PackedColour shadedPixel=pixel.scale(objectShadeFixed);
+							if (!shadedPixel.isOpaque())
+								shadedPixel=shadedPixel.blendOver(PackedColour::fromColour(palette->getColour(destIndex)));
+							destIndex=palette->getNearestIndex(shadedPixel);
+						}
+						if (debugView==DebugView::Overdraw)
+							++debugOverdraw[sx+sy*renderWidth];
+					} else if (!drawZBuffer) {
+						Colour shadedColour;
+						if (objectTextureIndices!=NULL) {
+							uint32_t shadedPixel=objectColourMap[objectTextureIndices[textureExtractX+textureExtractY*objectImage.width]];
+							shadedColour.r=(shadedPixel>>16)&255;
+							shadedColour.g=(shadedPixel>>8)&255;
+							shadedColour.b=shadedPixel&255;
+							shadedColour.a=pixel.getA();
+						} else
+							shadedColour=pixel.scale(objectShadeFixed).toColour();
+						SDL_SetRenderDrawColor(renderer, shadedColour.r, shadedColour.g, shadedColour.b, shadedColour.a);
 						SDL_RenderDrawPoint(renderer, sx, sy);
+						if (debugView==DebugView::Overdraw)
+							++debugOverdraw[sx+sy*renderWidth];
 					}
 				}
 			}
 		}
 
-		delete objects;
+	}
 
-		// If needed draw z-buffer
+	void Renderer::drawDebugView(bool drawZBuffer) {
+		// Generate image then upload and draw in one go.
+		debugPixels.resize(renderWidth*renderHeight);
 		if (drawZBuffer) {
-			for(int y=0; y<windowHeight; ++y) {
-				for(int x=0; x<windowWidth; ++x) {
-					double distance=zBuffer[x+y*windowWidth];
-					double factor=(distance>1.0 ? 1.0/distance : 1.0);
-					uint8_t colour=(int)floor(255*factor);
-
-					SDL_SetRenderDrawColor(renderer, colour, colour, colour, 255);
-					SDL_RenderDrawPoint(renderer, x, y);
-				}
+			for(int i=0; i<renderWidth*renderHeight; ++i) {
+				double distance=zBuffer[i];
+				double factor=(distance>1.0 ? 1.0/distance : 1.0);
+				uint32_t colour=(int)floor(255*factor);
+				debugPixels[i]=0xFF000000u|(colour<<16)|(colour<<8)|colour;
+			}
+		} else if (debugView==DebugView::Overdraw) {
+			for(int i=0; i<renderWidth*renderHeight; ++i)
+				debugPixels[i]=rendererHeatPixel((debugOverdraw[i]-1)/7.0);
+		} else {
+			// Per column views - fill each column with a single colour.
+			for(int x=0; x<renderWidth; ++x) {
+				const ColumnTrace &column=traces.columns[x];
+				uint32_t pixel=(debugView==DebugView::RaySteps ? rendererHeatPixel(column.stepsTraced/128.0) : rendererHeatPixel(column.slicesCount/16.0));
+				for(int y=0; y<renderHeight; ++y)
+					debugPixels[x+y*renderWidth]=pixel;
 			}
 		}
+
+		if (debugTexture==NULL) {
+			debugTexture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, renderWidth, renderHeight);
+			if (debugTexture==NULL)
+				return;
+			SDL_SetTextureBlendMode(debugTexture, SDL_BLENDMODE_NONE);
+		}
+		if (SDL_UpdateTexture(debugTexture, NULL, &debugPixels[0], renderWidth*sizeof(uint32_t))!=0)
+			return;
+		SDL_RenderCopy(renderer, debugTexture, NULL, NULL);
+	}
+
+	void Renderer::updateViewRenderer(Renderer *view) {
+		// Copy settings, only marking cached results dirty if they have actually changed.
+		if (!rendererColourEqual(view->colourGround, colourGround) || !rendererColourEqual(view->colourSky, colourSky) || !rendererColourEqual(view->colourBg, colourBg) || view->brightnessMin!=brightnessMin || view->brightnessMax!=brightnessMax) {
+			view->colourGround=colourGround;
+			view->colourSky=colourSky;
+			view->colourBg=colourBg;
+			view->backgroundGradientDirty=true;
+		}
+		view->skyTexture=skyTexture;
+		view->getFloorInfoFunctor=getFloorInfoFunctor;
+		view->getFloorInfoUserData=getFloorInfoUserData;
+		if (view->floorTimeBudget!=floorTimeBudget)
+			view->setFloorTimeBudget(floorTimeBudget);
+		view->blockHeightMax=blockHeightMax;
+		view->dynamicLights=dynamicLights;
+		view->dynamicLightBudget=dynamicLightBudget;
+		view->columnInterpolationStride=columnInterpolationStride;
+		view->temporalColumnReuse=temporalColumnReuse;
+		view->debugView=debugView;
+		view->indexedFramebuffer=indexedFramebuffer;
+
+		// Share our shading tables (which are already up to date) rather than computing them again.
+		if (view->palette!=palette || view->brightnessMin!=brightnessMin || view->brightnessMax!=brightnessMax || view->colourMapsDirty) {
+			view->palette=palette;
+			view->brightnessMin=brightnessMin;
+			view->brightnessMax=brightnessMax;
+			memcpy(view->colourMaps, colourMaps, sizeof(colourMaps));
+			memcpy(view->indexedShadeMaps, indexedShadeMaps, sizeof(indexedShadeMaps));
+			view->colourMapsDirty=false;
+		}
+
+		// Views are rendered at the same scale as we would be.
+		view->setRenderScale(getRenderScaleX(), getRenderScaleY());
 	}
 
 	void Renderer::renderTopDown(const Camera &camera) {
@@ -359,8 +770,8 @@ namespace TremorEngine {
 		const int xOffset=0;
 		const int yOffset=0;
 		const int divisor=4;
-		const int cellW=16*divisor;
-		const int cellH=16*divisor;
+		const int cellW=topDownCellSize*divisor;
+		const int cellH=topDownCellSize*divisor;
 
 		// Calculate constants
 		int cellsWide=windowWidth/cellW;
@@ -371,32 +782,22 @@ namespace TremorEngine {
 		int maxMapY=floor(camera.getY())+cellsHigh/2;
 		int x, y;
 
-		// Clear screen
-		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-		SDL_Rect rect={xOffset, yOffset, (cellsWide*cellW)/divisor, (cellsHigh*cellH)/divisor};
-		SDL_RenderFillRect(renderer, &rect);
-
-		// Draw blocks
-		for(y=minMapY;y<=maxMapY;++y) {
-			for(x=minMapX;x<=maxMapX;++x) {
-				// Grab block
-				BlockInfo blockInfo;
-				if (!getBlockInfoFunctor(x, y, &blockInfo, getBlockInfoUserData))
-					continue;
-
-				// Draw block
-				SDL_SetRenderDrawColor(renderer, blockInfo.colour.r, blockInfo.colour.g, blockInfo.colour.b, blockInfo.colour.a);
-				SDL_Rect rect={SX(x), SY(y), cellW/divisor, cellH/divisor};
-				SDL_RenderFillRect(renderer, &rect);
-			}
+		// Blocks and grid are drawn into a cached texture covering the visible cells and a margin around them, which is only redrawn if it no longer covers them (or a block has changed).
+		if (topDownTexture==NULL || topDownDirty || minMapX<topDownMinMapX || minMapY<topDownMinMapY || maxMapX>topDownMaxMapX || maxMapY>topDownMaxMapY) {
+			if (!updateTopDownTexture(minMapX-cellsWide, minMapY-cellsHigh, maxMapX+cellsWide, maxMapY+cellsHigh))
+				return;
 		}
 
-		// Draw grid over blocks
-		SDL_SetRenderDrawColor(renderer, 196, 196, 196, 255);
-		for(x=minMapX;x<=maxMapX;++x)
-			SDL_RenderDrawLine(renderer, SX(x), yOffset, SX(x), windowHeight/divisor+yOffset);
-		for(y=minMapY;y<=maxMapY;++y)
-			SDL_RenderDrawLine(renderer, xOffset, SY(y), windowWidth/divisor+xOffset, SY(y));
+		// Copy visible region of cached texture.
+		// Note: offset is computed as for the cells themselves (rounding down) so that they appear in exactly the same place as if drawn directly.
+		SDL_Rect clipRect={xOffset, yOffset, (cellsWide*cellW)/divisor, (cellsHigh*cellH)/divisor};
+		SDL_Rect destRect;
+		destRect.x=((int)floor(floor(windowWidth/2+cellW*(camera.getX()-topDownMaxMapX))/divisor))+xOffset;
+		destRect.y=((int)floor(floor(windowHeight/2+cellH*(camera.getY()-topDownMaxMapY))/divisor))+yOffset;
+		SDL_QueryTexture(topDownTexture, NULL, NULL, &destRect.w, &destRect.h);
+		SDL_RenderSetClipRect(renderer, &clipRect);
+		SDL_RenderCopy(renderer, topDownTexture, NULL, &destRect);
+		SDL_RenderSetClipRect(renderer, NULL);
 
 		// Trace ray and highlight cells it intersects
 		Ray ray(camera.getX(), camera.getY(), camera.getYaw());
@@ -427,21 +828,1306 @@ namespace TremorEngine {
 		// Draw camera's line of sight
 		SDL_SetRenderDrawColor(renderer, 0, 255, 0, 255);
 		double len=64.0;
-		SDL_RenderDrawLine(renderer, SX(camera.getX()), SY(camera.getY()), SX(camera.getX()+cos(camera.getYaw())*len), SY(camera.getY()+sin(camera.getYaw())*len));
+		SDL_RenderDrawLine(renderer, SX(camera.getX()), SY(camera.getY()), SX(camera.getX()+camera.getDirX()*len), SY(camera.getY()+camera.getDirY()*len));
 
 		#undef SX
 		#undef SY
 	}
 
+	bool Renderer::updateTopDownTexture(int minMapX, int minMapY, int maxMapX, int maxMapY) {
+		// Create texture, reusing existing one if it is the right size.
+		// Cell (maxMapX,maxMapY) is at the top left, as the view is mirrored (see renderTopDown).
+		int width=(maxMapX-minMapX+1)*topDownCellSize+1, height=(maxMapY-minMapY+1)*topDownCellSize+1;
+		int textureWidth=0, textureHeight=0;
+		if (topDownTexture!=NULL)
+			SDL_QueryTexture(topDownTexture, NULL, NULL, &textureWidth, &textureHeight);
+		if (textureWidth!=width || textureHeight!=height) {
+			if (topDownTexture!=NULL)
+				SDL_DestroyTexture(topDownTexture);
+			topDownTexture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height);
+			if (topDownTexture==NULL)
+				return false;
+			SDL_SetTextureBlendMode(topDownTexture, SDL_BLENDMODE_NONE);
+		}
+
+		topDownMinMapX=minMapX;
+		topDownMinMapY=minMapY;
+		topDownMaxMapX=maxMapX;
+		topDownMaxMapY=maxMapY;
+		topDownDirty=false;
+
+		SDL_Texture *windowTarget=SDL_GetRenderTarget(renderer);
+		SDL_Rect windowViewport;
+		SDL_RenderGetViewport(renderer, &windowViewport);
+		SDL_SetRenderTarget(renderer, topDownTexture);
+
+		// Clear
+		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+		SDL_Rect rect={0, 0, width, height};
+		SDL_RenderFillRect(renderer, &rect);
+
+		// Draw blocks
+		for(int y=minMapY; y<=maxMapY; ++y) {
+			for(int x=minMapX; x<=maxMapX; ++x) {
+				// Grab block
+				BlockInfo blockInfo;
+				if (!getBlockInfoFunctor(x, y, &blockInfo, getBlockInfoUserData))
+					continue;
+
+				// Draw block
+				SDL_SetRenderDrawColor(renderer, blockInfo.colour.r, blockInfo.colour.g, blockInfo.colour.b, blockInfo.colour.a);
+				SDL_Rect rect={(maxMapX-x)*topDownCellSize, (maxMapY-y)*topDownCellSize, topDownCellSize, topDownCellSize};
+				SDL_RenderFillRect(renderer, &rect);
+			}
+		}
+
+		// Draw grid over blocks
+		SDL_SetRenderDrawColor(renderer, 196, 196, 196, 255);
+		for(int x=0; x<width; x+=topDownCellSize)
+			SDL_RenderDrawLine(renderer, x, 0, x, height-1);
+		for(int y=0; y<height; y+=topDownCellSize)
+			SDL_RenderDrawLine(renderer, 0, y, width-1, y);
+
+		// Changing target resets the viewport.
+		SDL_SetRenderTarget(renderer, windowTarget);
+		SDL_RenderSetViewport(renderer, &windowViewport);
+
+		return true;
+	}
+
+	bool Renderer::resizeRender(int width, int height) {
+		assert(width>0 && height>0);
+
+		// Allocate new z-buffer first, so on failure the old size and buffer are left as they were.
+		double *newZBuffer=(double *)malloc(sizeof(double)*width*height);
+		if (newZBuffer==NULL)
+			return false;
+		free(zBuffer);
+		zBuffer=newZBuffer;
+
+		renderWidth=width;
+		renderHeight=height;
+		unitBlockHeight=windowUnitBlockHeight*(((double)renderHeight)/windowHeight);
+		renderScaleRatio=(((double)renderHeight)*windowWidth)/(((double)renderWidth)*windowHeight);
+
+		// Discard any textures of the old size (these are recreated on first use).
+		if (renderTexture!=NULL) {
+			SDL_DestroyTexture(renderTexture);
+			renderTexture=NULL;
+		}
+		if (backgroundTexture!=NULL) {
+			SDL_DestroyTexture(backgroundTexture);
+			backgroundTexture=NULL;
+		}
+		if (backgroundGradientTexture!=NULL) {
+			SDL_DestroyTexture(backgroundGradientTexture);
+			backgroundGradientTexture=NULL;
+		}
+		if (debugTexture!=NULL) {
+			SDL_DestroyTexture(debugTexture);
+			debugTexture=NULL;
+		}
+		if (indexedTexture!=NULL) {
+			SDL_DestroyTexture(indexedTexture);
+			indexedTexture=NULL;
+		}
+		indexedPixels.resize(renderWidth*renderHeight);
+		pipelinePixels.resize(renderWidth*renderHeight);
+		pipelineFrameReady=false;
+
+		// Horizon can be anywhere in interval [renderHeight/2-renderHeight, renderHeight/2+renderHeight] (see cameraPitchScreenAdjustment in render) so this covers every row.
+		// i.e. the offset is the furthest the top row can be above the horizon, and the rows after it reach the furthest the bottom row can be below it (one further for odd heights).
+		backgroundGradientDirty=true;
+		backgroundGradientOffset=renderHeight/2+renderHeight;
+		backgroundGradientHeight=backgroundGradientOffset+(renderHeight-1)-(renderHeight/2-renderHeight)+1;
+
+		dynamicLightTiles.resize((renderWidth+dynamicLightTileWidth-1)/dynamicLightTileWidth, 0);
+
+		// Columns from the previous frame no longer line up with ours, so cannot be reused.
+		traces.columns.resize(renderWidth);
+		prevTraces.columns.resize(renderWidth);
+		for(int x=0; x<renderWidth; ++x) {
+			traces.columns[x].ready=false;
+			prevTraces.columns[x].ready=false;
+		}
+
+		return true;
+	}
+
+	void Renderer::updateFrameTime(MicroSeconds frameTime) {
+		if (frameTimeTarget<=0)
+			return;
+
+		// Smooth out individual slow (or fast) frames.
+		const double smoothing=0.1;
+		frameTimeAverage=(frameTimeAverage>0.0 ? frameTimeAverage+(frameTime-frameTimeAverage)*smoothing : frameTime);
+
+		// Give the average a chance to reflect the current scale before adjusting it again.
+		if (frameTimeSettleFrames>0) {
+			--frameTimeSettleFrames;
+			return;
+		}
+
+		// Leave scale alone if we are within target, unless comfortably so (to avoid flickering between sizes).
+		double ratio=frameTimeTarget/std::max(frameTimeAverage, 1.0);
+		if (ratio>=1.0 && ratio<1.25)
+			return;
+
+		// Time is roughly proportional to the number of pixels rendered, so scale each axis by the square root of how far we are from target (aiming a little under it).
+		double scale=sqrt(getRenderScaleX()*getRenderScaleY());
+		double newScale=std::max(frameTimeMinScale, std::min(scale*sqrt(0.9*ratio), 1.0));
+		if (fabs(newScale-scale)<0.05*scale)
+			return;
+
+		setRenderScale(newScale, newScale);
+		frameTimeAverage=0.0;
+		frameTimeSettleFrames=8;
+	}
+
+	bool Renderer::isDrawingFloors(void) const {
+		return (getFloorInfoFunctor!=NULL && floorTimeFallbackFramesLeft==0);
+	}
+
+	void Renderer::updateFloorTime(MicroSeconds floorTime) {
+		if (floorTimeBudget<=0)
+			return;
+
+		// Already over budget? If so wait a while before trying textured floors again.
+		if (floorTimeFallbackFramesLeft>0) {
+			--floorTimeFallbackFramesLeft;
+			return;
+		}
+		if (floorTime<=0)
+			return;
+
+		// Smooth out individual slow frames, as with updateFrameTime.
+		const double smoothing=0.1;
+		floorTimeAverage=(floorTimeAverage>0.0 ? floorTimeAverage+(floorTime-floorTimeAverage)*smoothing : floorTime);
+		if (floorTimeAverage<=floorTimeBudget)
+			return;
+
+		floorTimeAverage=0.0;
+		floorTimeFallbackFramesLeft=floorTimeFallbackFrames;
+	}
+
+	void Renderer::traceColumns(const FrameParameters &params) {
+		const Camera &camera=*params.camera;
+
+		// Keep previous frame's results, and clear current ones (this does not free memory).
+		std::swap(traces, prevTraces);
+		traces.cameraX=camera.getX();
+		traces.cameraY=camera.getY();
+		traces.cameraMaxDist=camera.getMaxDist();
+		traces.slices.clear();
+		traces.steps.clear();
+		for(auto &column : traces.columns)
+			column.ready=false;
+
+		// If the rays start from the same point as last frame we can derive many (if not all) columns from those results.
+		if (temporalColumnReuse && prevTraces.cameraX==traces.cameraX && prevTraces.cameraY==traces.cameraY && prevTraces.cameraMaxDist==traces.cameraMaxDist)
+			reuseColumns(params);
+
+		// Trace every n-th column, and then fill in those in between.
+		int leftX=0;
+		resolveColumn(params, leftX);
+		while(leftX<renderWidth-1) {
+			int rightX=std::min(leftX+columnInterpolationStride, renderWidth-1);
+			resolveColumn(params, rightX);
+			traceColumnsBetween(params, leftX, rightX);
+			leftX=rightX;
+		}
+	}
+
+	void Renderer::traceColumnsBetween(const FrameParameters &params, int leftX, int rightX) {
+		// No columns in between?
+		if (rightX-leftX<2)
+			return;
+
+		// If the rays either side passed through the same cells then derive the columns in between.
+		// Note: this can still fail for individual columns, if say they would stop tracing at a different point, so we fall back to tracing these.
+		if (compareColumnPaths(traces, traces.columns[leftX], traces.columns[rightX])) {
+			for(int x=leftX+1; x<rightX; ++x)
+				if (!traces.columns[x].ready && !deriveColumn(params, x, traces, traces.columns[leftX]))
+					traceColumn(params, x);
+			return;
+		}
+
+		// Otherwise there is a discontinuity somewhere in between - trace middle column and try again either side of it.
+		int midX=(leftX+rightX)/2;
+		resolveColumn(params, midX);
+		traceColumnsBetween(params, leftX, midX);
+		traceColumnsBetween(params, midX, rightX);
+	}
+
+	void Renderer::reuseColumns(const FrameParameters &params) {
+		// Both sets of column angles are increasing, so we can sweep through the previous frame's columns to find the pair either side of each new column.
+		int prevX=0;
+		for(int x=0; x<renderWidth; ++x) {
+			double angle=computeColumnAngle(params, x);
+			while(prevX+1<renderWidth && prevTraces.columns[prevX+1].angle<=angle)
+				++prevX;
+
+			const ColumnTrace &left=prevTraces.columns[prevX];
+			if (left.angle>angle)
+				continue; // newly exposed on the left
+			if (left.angle==angle) {
+				// Same ray as before (e.g. camera has not turned).
+				if (left.ready)
+					deriveColumn(params, x, prevTraces, left);
+				continue;
+			}
+			if (prevX+1>=renderWidth)
+				continue; // newly exposed on the right
+
+			const ColumnTrace &right=prevTraces.columns[prevX+1];
+			if (left.ready && right.ready && compareColumnPaths(prevTraces, left, right))
+				deriveColumn(params, x, prevTraces, left);
+		}
+	}
+
+	void Renderer::resolveColumn(const FrameParameters &params, int x) {
+		if (!traces.columns[x].ready)
+			traceColumn(params, x);
+	}
+
+	void Renderer::traceColumn(const FrameParameters &params, int x) {
+		const Camera &camera=*params.camera;
+		ColumnTrace &column=traces.columns[x];
+
+		column.ready=true;
+		column.angle=computeColumnAngle(params, x);
+		camera.getColumnDirection(x, renderWidth, &column.dirX, &column.dirY);
+		column.slicesStart=traces.slices.size();
+		column.stepsStart=traces.steps.size();
+		column.stepsCount=0;
+		column.occluded=false;
+
+		// Trace ray from view point at this angle to collect a list of 'slices' of blocks to later draw.
+		Ray ray(camera.getX(), camera.getY(), column.dirX, column.dirY);
+		ColumnCoverage coverage={.top=0, .bottom=renderHeight-1};
+		column.stepX=ray.getStepX();
+		column.stepY=ray.getStepY();
+
+		ray.next(); // advance ray to first intersection point
+		pushColumnStep(column, ray.getSide());
+		while(ray.getTrueDistance()<camera.getMaxDist()) {
+			// Get info for block at current ray position.
+			BlockInfo blockInfo;
+			if (!getBlockInfoFunctor(ray.getMapX(), ray.getMapY(), &blockInfo, getBlockInfoUserData)) {
+				ray.next(); // advance ray here as we skip proper advancing futher in loop body
+				pushColumnStep(column, ray.getSide());
+				continue; // no block
+			}
+
+			BlockDisplaySlice slice;
+			slice.texture=blockInfo.texture;
+			slice.colour=blockInfo.colour;
+			slice.blockHeight=blockInfo.height;
+			slice.mapX=ray.getMapX();
+			slice.mapY=ray.getMapY();
+
+			// Compute other fields and push slice to list.
+			// If the column is now covered, no point searching further.
+			// Note: we push slices even if they are hidden, as they may not be for a column derived from this one.
+			bool occluded=computeSlice(params, coverage, ray, blockInfo.lightmap, slice);
+			traces.slices.push_back(slice);
+			if (occluded) {
+				column.occluded=true;
+				break;
+			}
+			pushColumnStep(column, ray.getSide());
+		}
+
+		column.slicesCount=traces.slices.size()-column.slicesStart;
+		column.endMapX=ray.getMapX();
+		column.endMapY=ray.getMapY();
+		column.endSide=ray.getSide();
+		column.stepsTraced=column.stepsCount;
+	}
+
+	bool Renderer::deriveColumn(const FrameParameters &params, int x, const ColumnTraces &source, const ColumnTrace &neighbour) {
+		const Camera &camera=*params.camera;
+		ColumnTrace &column=traces.columns[x];
+
+		// As the rays either side took the same path, this ray passes through exactly the same cells as they do.
+		// So we can skip straight to each block found, recomputing only the values which depend on the ray's angle.
+		column.angle=computeColumnAngle(params, x);
+		camera.getColumnDirection(x, renderWidth, &column.dirX, &column.dirY);
+		column.slicesStart=traces.slices.size();
+		column.slicesCount=neighbour.slicesCount;
+		column.stepX=neighbour.stepX;
+		column.stepY=neighbour.stepY;
+		column.stepsCount=neighbour.stepsCount;
+		column.stepsTraced=0;
+		column.occluded=neighbour.occluded;
+		column.endMapX=neighbour.endMapX;
+		column.endMapY=neighbour.endMapY;
+		column.endSide=neighbour.endSide;
+
+		Ray ray(camera.getX(), camera.getY(), column.dirX, column.dirY);
+		ColumnCoverage coverage={.top=0, .bottom=renderHeight-1};
+		for(size_t i=0; i<neighbour.slicesCount; ++i) {
+			BlockDisplaySlice slice=source.slices[neighbour.slicesStart+i]; // note: copy rather than reference as we may push to the same vector below
+			ray.skipTo(slice.mapX, slice.mapY, slice.intersectionSide);
+
+			// Light levels depend on where the wall is hit, so look up the block's lightmap again (slices do not keep it, to stay compact).
+			BlockInfo blockInfo;
+			if (!getBlockInfoFunctor(slice.mapX, slice.mapY, &blockInfo, getBlockInfoUserData)) {
+				traces.slices.resize(column.slicesStart);
+				return false;
+			}
+
+			// Column should be covered after this slice if and only if it is the last one (as with either side), otherwise this ray would have stopped elsewhere.
+			bool occluded=computeSlice(params, coverage, ray, blockInfo.lightmap, slice);
+			if (occluded!=(neighbour.occluded && i==neighbour.slicesCount-1)) {
+				traces.slices.resize(column.slicesStart);
+				return false;
+			}
+
+			traces.slices.push_back(slice);
+		}
+
+		// If we stopped due to distance check this ray would have also stopped at the same point.
+		// Note: intersections before this point cannot be further away than the same intersections either side, so those need not be checked.
+		if (!neighbour.occluded) {
+			ray.skipTo(neighbour.endMapX, neighbour.endMapY, neighbour.endSide);
+			if (ray.getTrueDistance()<camera.getMaxDist()) {
+				traces.slices.resize(column.slicesStart);
+				return false;
+			}
+		}
+
+		// Path is the same as either side - if these are from the previous frame then we need our own copy, otherwise we can share.
+		if (&source==&traces)
+			column.stepsStart=neighbour.stepsStart;
+		else {
+			column.stepsStart=traces.steps.size();
+			size_t words=(neighbour.stepsCount+31)/32;
+			traces.steps.insert(traces.steps.end(), source.steps.begin()+neighbour.stepsStart, source.steps.begin()+neighbour.stepsStart+words);
+		}
+
+		column.ready=true;
+
+		return true;
+	}
+
+	bool Renderer::computeSlice(const FrameParameters &params, ColumnCoverage &coverage, Ray &ray, const uint8_t *lightmap, BlockDisplaySlice &slice) {
+		double distance=ray.getTrueDistance();
+		slice.distance=distance;
+		slice.intersectionSide=ray.getSide();
+		slice.blockDisplayBase=computeBlockDisplayBase(distance, params.cameraZScreenAdjustment, params.cameraPitchScreenAdjustment);
+		slice.blockDisplayHeight=slice.blockDisplayBase-computeBlockDisplayTop(slice.blockHeight, distance, params.cameraZScreenAdjustment, params.cameraPitchScreenAdjustment);
+		if (slice.texture!=NULL) {
+			int textureW=slice.texture->getWidth();
+			slice.blockTextureX=ray.getTextureX(textureW);
+		}
+
+		// Look up light levels for the part of the wall hit (the face is the one the ray enters the block through) and the top.
+		slice.light=255;
+		slice.topLight=255;
+		if (lightmap!=NULL) {
+			BlockFace face;
+			if (slice.intersectionSide==Ray::Side::Vertical)
+				face=(ray.getStepX()>0 ? BlockFace::MinX : BlockFace::MaxX);
+			else
+				face=(ray.getStepY()>0 ? BlockFace::MinY : BlockFace::MaxY);
+			int column=std::min((int)(ray.getWallOffset()*lightmapColumns), lightmapColumns-1);
+			slice.light=lightmap[((int)face)*lightmapColumns+column];
+			slice.topLight=lightmap[((int)BlockFace::Top)*lightmapColumns];
+		}
+
+		// Advance ray to next itersection now ready for next iteration, and for use in block top calculations.
+		ray.next();
+
+		// If top of block is visible, compute some extra stuff.
+		int blockDisplayTop=slice.blockDisplayBase-slice.blockDisplayHeight;
+		int sliceDisplayTop=blockDisplayTop;
+		if (blockDisplayTop>params.horizonHeight) {
+			double nextDistance=ray.getTrueDistance();
+			int nextBlockDisplayTop=computeBlockDisplayTop(slice.blockHeight, nextDistance, params.cameraZScreenAdjustment, params.cameraPitchScreenAdjustment);
+			slice.blockDisplayTopSize=blockDisplayTop-nextBlockDisplayTop;
+			sliceDisplayTop=nextBlockDisplayTop;
+		}
+
+		// Clip slice to the rows which are still uncovered (if it does not reach these then it is hidden).
+		slice.drawTop=std::max(sliceDisplayTop, coverage.top);
+		slice.drawBottom=std::min((int)slice.blockDisplayBase, coverage.bottom);
+
+		// Find rows this slice covers directly - all of them if opaque, otherwise only the top (which is always a solid colour) as further slices may be seen through the walls.
+		bool opaque=isSliceOpaque(slice);
+		int coveredTop=sliceDisplayTop;
+		int coveredBottom=(opaque ? (int)slice.blockDisplayBase : (blockDisplayTop>params.horizonHeight ? blockDisplayTop : sliceDisplayTop-1));
+
+		// Update coverage, first with these rows.
+		if (coveredTop<=coverage.top && coveredBottom>=coverage.top)
+			coverage.top=coveredBottom+1;
+		if (coveredTop<=coverage.bottom && coveredBottom>=coverage.bottom)
+			coverage.bottom=coveredTop-1;
+
+		// Further slices are at least as far away as this one, so (as long as the camera is above the ground) their bases cannot be lower than this one's.
+		// So rows below this slice (or below its base if it is transparent) can never be drawn to again.
+		if (0.5*unitBlockHeight+params.cameraZScreenAdjustment>=0.0)
+			coverage.bottom=std::min(coverage.bottom, (opaque ? sliceDisplayTop-1 : (int)slice.blockDisplayBase));
+
+		// Similarly, if we know the height of the tallest block, their tops cannot be any higher than such a block would be at this distance.
+		// (or the horizon, if the tallest block is below the camera)
+		if (blockHeightMax<std::numeric_limits<double>::infinity()) {
+			double cameraHeightFraction=0.5+((double)params.cameraZScreenAdjustment)/unitBlockHeight;
+			int highestDisplayTop=computeDisplayY(std::max(blockHeightMax, cameraHeightFraction), distance, params.cameraZScreenAdjustment, params.cameraPitchScreenAdjustment);
+			coverage.top=std::max(coverage.top, highestDisplayTop);
+		}
+
+		return (coverage.top>coverage.bottom);
+	}
+
+	void Renderer::pushColumnStep(ColumnTrace &column, Ray::Side side) {
+		// Columns are traced one at a time so the column's steps are always at the end of the array.
+		if (column.stepsCount%32==0)
+			traces.steps.push_back(0);
+		if (side==Ray::Side::Vertical)
+			traces.steps.back()|=(((uint32_t)1)<<(column.stepsCount%32));
+		++column.stepsCount;
+	}
+
+	bool Renderer::compareColumnPaths(const ColumnTraces &source, const ColumnTrace &a, const ColumnTrace &b) const {
+		// Note: the steps only record which axis the ray moved along, so we must also check they moved in the same directions.
+		if (a.stepX!=b.stepX || a.stepY!=b.stepY || a.stepsCount!=b.stepsCount || a.occluded!=b.occluded)
+			return false;
+
+		// Note: unused bits in the last word are always clear so can be compared too.
+		size_t words=(a.stepsCount+31)/32;
+		return (memcmp(&source.steps[a.stepsStart], &source.steps[b.stepsStart], sizeof(uint32_t)*words)==0);
+	}
+
+	double Renderer::computeColumnAngle(const FrameParameters &params, int x) const {
+		double deltaAngle=atan((x-renderWidth/2)/params.screenDist);
+		return params.camera->getYaw()+deltaAngle;
+	}
+
+	bool Renderer::updateBackgroundGradient(void) {
+		if (!backgroundGradientDirty)
+			return true;
+
+		// Create texture if needed.
+		int gradientHeight=backgroundGradientHeight;
+		if (backgroundGradientTexture==NULL) {
+			backgroundGradientTexture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 1, gradientHeight);
+			if (backgroundGradientTexture==NULL)
+				return false;
+			SDL_SetTextureBlendMode(backgroundGradientTexture, SDL_BLENDMODE_BLEND); // same as drawing lines of the colour directly
+		}
+
+		// Compute colour of each row.
+		backgroundGradientPixels.resize(gradientHeight);
+		for(int i=0; i<gradientHeight; ++i) {
+			// Calculate distance in order to adjust colour.
+			int horizonOffset=i-backgroundGradientOffset; // equivalent to y-horizonHeight for screen row y
+			double distance=unitBlockHeight/(2*abs(horizonOffset));
+
+			// Sky above horizon, ground below
+			Colour colour=(horizonOffset<0 ? colourSky : colourGround);
+			colourAdjustForDistance(colour, distance);
+			backgroundGradientPixels[i]=rendererColourToPixel(colour, colour.a);
+		}
+
+		if (SDL_UpdateTexture(backgroundGradientTexture, NULL, &backgroundGradientPixels[0], sizeof(uint32_t))!=0)
+			return false;
+
+		backgroundGradientDirty=false;
+
+		return true;
+	}
+
+	void Renderer::computeBackgroundColumns(const FrameParameters &params) {
+		double skyTextureLeftX=0.0, skyScreenPixelsPerTexel=1.0;
+		int skyDisplayTop=0, skyDisplayHeight=1;
+		if (skyTexture!=NULL)
+			computeSkyDisplay(params, &skyTextureLeftX, &skyScreenPixelsPerTexel, &skyDisplayTop, &skyDisplayHeight);
+
+		// Compute direction of each column's ray, and which rows the nearest block will cover (so we can skip these).
+		// Note: distances are measured along the ray (as they are for walls), so a whole row of the floor is at the same distance, but the points are not evenly spaced across the row.
+		backgroundColumns.resize(renderWidth);
+		for(int x=0; x<renderWidth; ++x) {
+			const ColumnTrace &column=traces.columns[x];
+			BackgroundColumn &backgroundColumn=backgroundColumns[x];
+			backgroundColumn.dirX=column.dirX;
+			backgroundColumn.dirY=column.dirY;
+			backgroundColumn.coveredTop=0;
+			backgroundColumn.coveredBottom=-1;
+			for(size_t i=0; i<column.slicesCount; ++i) {
+				// Background can be seen through transparent slices, so use the nearest opaque one.
+				const BlockDisplaySlice &slice=traces.slices[column.slicesStart+i];
+				if (!isSliceOpaque(slice))
+					continue;
+				backgroundColumn.coveredTop=slice.drawTop;
+				backgroundColumn.coveredBottom=slice.drawBottom;
+				break;
+			}
+			if (skyTexture!=NULL) {
+				// Note: this matches the linear mapping used by drawSky (rather than using the column's exact angle).
+				int textureW=skyTexture->getWidth();
+				backgroundColumn.skyTextureX=((int)(skyTextureLeftX+(x+0.5)/skyScreenPixelsPerTexel))%textureW;
+			}
+		}
+	}
+
+	void Renderer::computeSkyDisplay(const FrameParameters &params, double *textureLeftX, double *screenPixelsPerTexel, int *displayTop, int *displayHeight) const {
+		// Texture is scrolled horizontally based on yaw, and scaled so that the field of view covers the correct fraction of its width.
+		const Camera &camera=*params.camera;
+		double fov=camera.getFov();
+		double textureW=skyTexture->getWidth();
+		*textureLeftX=angleNormalise(camera.getYaw()-fov/2.0)/(2.0*M_PI)*textureW;
+		*screenPixelsPerTexel=renderWidth/(textureW*fov/(2.0*M_PI));
+
+		// Vertically the aspect ratio is kept if possible, but it must be at least tall enough to cover the top of the screen for any horizon height.
+		*displayHeight=std::max((int)(skyTexture->getHeight()*(*screenPixelsPerTexel)*renderScaleRatio), backgroundGradientOffset);
+		*displayTop=params.horizonHeight-*displayHeight;
+	}
+
+	void Renderer::drawBackground(const FrameParameters &params) {
+		if (!updateBackgroundGradient())
+			return;
+
+		bool floors=isDrawingFloors();
+		if (floors || skyTexture!=NULL)
+			computeBackgroundColumns(params);
+
+		if (isIndexed()) {
+			drawBackgroundIndexed(params);
+			return;
+		}
+
+		if (floors) {
+			drawBackgroundTextured(params);
+			return;
+		}
+
+		// No sky texture? If so simply stretch section of gradient for current horizon over the whole screen.
+		if (skyTexture==NULL) {
+			SDL_Rect srcRect={.x=0, .y=backgroundGradientOffset-params.horizonHeight, .w=1, .h=renderHeight};
+			SDL_RenderCopy(renderer, backgroundGradientTexture, &srcRect, NULL);
+			return;
+		}
+
+		// Otherwise draw ground from gradient and then sky on top.
+		int groundTop=std::max(params.horizonHeight, 0);
+		if (groundTop<renderHeight) {
+			SDL_Rect srcRect={.x=0, .y=backgroundGradientOffset+groundTop-params.horizonHeight, .w=1, .h=renderHeight-groundTop};
+			SDL_Rect destRect={.x=0, .y=groundTop, .w=renderWidth, .h=renderHeight-groundTop};
+			SDL_RenderCopy(renderer, backgroundGradientTexture, &srcRect, &destRect);
+		}
+
+		drawSky(params);
+	}
+
+	void Renderer::drawSky(const FrameParameters &params) {
+		// Find the lowest row we need to draw to, as in every column the rows between the nearest block's top and the horizon are drawn over anyway.
+		int skyRowsEnd=0;
+		for(int x=0; x<renderWidth; ++x) {
+			const BackgroundColumn &backgroundColumn=backgroundColumns[x];
+			int columnSkyRowsEnd=(backgroundColumn.coveredTop<=backgroundColumn.coveredBottom && backgroundColumn.coveredBottom>=params.horizonHeight-1 ? backgroundColumn.coveredTop : params.horizonHeight);
+			skyRowsEnd=std::max(skyRowsEnd, std::min(columnSkyRowsEnd, params.horizonHeight));
+		}
+		skyRowsEnd=std::min(skyRowsEnd, renderHeight);
+		if (skyRowsEnd<=0)
+			return;
+
+		double textureLeftX, screenPixelsPerTexel;
+		int displayTop, displayHeight;
+		computeSkyDisplay(params, &textureLeftX, &screenPixelsPerTexel, &displayTop, &displayHeight);
+
+		// Draw the visible texels, wrapping around to the start of the texture if needed, hence at most two copies.
+		// Note: whole texels are copied, positioned (and clipped by the screen edges) such that scrolling is still smooth.
+		SDL_Rect clipRect={.x=0, .y=0, .w=renderWidth, .h=skyRowsEnd};
+		SDL_RenderSetClipRect(renderer, &clipRect);
+
+		int textureW=skyTexture->getWidth();
+		int texelsStart=floor(textureLeftX);
+		int texelsEnd=ceil(textureLeftX+renderWidth/screenPixelsPerTexel);
+		for(int part=0; part<2; ++part) {
+			int partStart=(part==0 ? texelsStart : textureW);
+			int partEnd=std::min(texelsEnd, (part==0 ? textureW : 2*textureW));
+			if (partStart>=partEnd)
+				continue;
+
+			int destX0=floor((partStart-textureLeftX)*screenPixelsPerTexel);
+			int destX1=floor((partEnd-textureLeftX)*screenPixelsPerTexel);
+			SDL_Rect srcRect={.x=partStart-part*textureW, .y=0, .w=partEnd-partStart, .h=skyTexture->getHeight()};
+			SDL_Rect destRect={.x=destX0, .y=displayTop, .w=destX1-destX0, .h=displayHeight};
+			SDL_RenderCopy(renderer, skyTexture->getSdlTexture(), &srcRect, &destRect);
+		}
+
+		SDL_RenderSetClipRect(renderer, NULL);
+	}
+
+	void Renderer::drawBackgroundTextured(const FrameParameters &params) {
+		const Camera &camera=*params.camera;
+
+		// Create streaming texture if needed.
+		if (backgroundTexture==NULL) {
+			backgroundTexture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, renderWidth, renderHeight);
+			if (backgroundTexture==NULL)
+				return;
+			SDL_SetTextureBlendMode(backgroundTexture, SDL_BLENDMODE_NONE);
+		}
+
+		void *texturePixels;
+		int texturePitch;
+		if (SDL_LockTexture(backgroundTexture, NULL, &texturePixels, &texturePitch)!=0)
+			return;
+
+		// Sky texture position, if any.
+		double skyTextureLeftX=0.0, skyScreenPixelsPerTexel=1.0;
+		int skyDisplayTop=0, skyDisplayHeight=1;
+		if (skyTexture!=NULL)
+			computeSkyDisplay(params, &skyTextureLeftX, &skyScreenPixelsPerTexel, &skyDisplayTop, &skyDisplayHeight);
+
+		double cameraX=camera.getX();
+		double cameraY=camera.getY();
+
+		// Loop over each row, finding the distance to the point on the ground (or ceiling) seen through the centre of the row's pixels.
+		// This is the inverse of computeDisplayY, so floors line up exactly with the bases (or unit height tops) of blocks.
+		for(int y=0; y<renderHeight; ++y) {
+			uint32_t *rowPixels=(uint32_t *)(((uint8_t *)texturePixels)+y*texturePitch);
+
+			bool isGround=(y>=params.horizonHeight);
+			double rowOffset=y+0.5-params.horizonHeight;
+			double planeOffset=(isGround ? 0.5*unitBlockHeight : -0.5*unitBlockHeight)+params.cameraZScreenAdjustment;
+			double distance=planeOffset/rowOffset;
+
+			// Flat colour for any cells without a texture is the same as when not using textured floors.
+			// (or row of the sky texture, if any, when above the horizon)
+			uint32_t flatPixel=backgroundGradientPixels[y-params.horizonHeight+backgroundGradientOffset];
+			const PackedColour *skyRowPixels=NULL;
+			if (!isGround && skyTexture!=NULL) {
+				int skyTextureY=((y-skyDisplayTop)*skyTexture->getHeight())/skyDisplayHeight;
+				skyRowPixels=skyTexture->getPixels()+skyTextureY*skyTexture->getWidth();
+			}
+
+			// If plane is not visible in this row (e.g. camera is above the ceiling), or beyond the camera's max distance (as are blocks), just use flat colour.
+			if (distance<=0.0 || distance>=camera.getMaxDist()) {
+				for(int x=0; x<renderWidth; ++x)
+					rowPixels[x]=(skyRowPixels!=NULL ? rendererPackedColourToPixel(skyRowPixels[backgroundColumns[x].skyTextureX]) : flatPixel);
+				continue;
+			}
+
+			// Shading is the same for the whole row, so compute it once as a fixed point factor (or choose the light level table if using a palette).
+			uint32_t shade=colourDistanceFactor(distance)*256;
+			const uint32_t *colourMap=(palette!=NULL ? colourMaps[computeLightLevel(distance)] : NULL);
+
+			int cellX=INT_MIN, cellY=INT_MIN;
+			const PackedColour *texturePixelsSrc=NULL;
+			const uint8_t *textureIndicesSrc=NULL; // set if texture is quantized to our palette
+			int textureW=0, textureH=0;
+			for(int x=0; x<renderWidth; ++x) {
+				const BackgroundColumn &backgroundColumn=backgroundColumns[x];
+				if (y>=backgroundColumn.coveredTop && y<=backgroundColumn.coveredBottom)
+					continue;
+
+				double worldX=cameraX+distance*backgroundColumn.dirX;
+				double worldY=cameraY+distance*backgroundColumn.dirY;
+				int pixelCellX=worldX, pixelCellY=worldY; // round towards zero and then adjust to round down (cheaper than calling floor)
+				pixelCellX-=(worldX<pixelCellX);
+				pixelCellY-=(worldY<pixelCellY);
+
+				// Entered a new cell? If so look up its textures (neighbouring pixels are usually in the same cell, so this is rarely needed).
+				// Note: map coordinates are offset by one (see Ray::getMapX).
+				if (pixelCellX!=cellX || pixelCellY!=cellY) {
+					cellX=pixelCellX;
+					cellY=pixelCellY;
+					FloorInfo info;
+					Texture *texture=NULL;
+					if (getFloorInfoFunctor(cellX+1, cellY+1, &info, getFloorInfoUserData))
+						texture=(isGround ? info.floorTexture : info.ceilingTexture);
+					if (texture!=NULL) {
+						texturePixelsSrc=texture->getPixels();
+						textureIndicesSrc=(colourMap!=NULL && texture->getPalette()==palette ? texture->getPaletteIndices() : NULL);
+						textureW=texture->getWidth();
+						textureH=texture->getHeight();
+					} else
+						texturePixelsSrc=NULL;
+				}
+
+				if (texturePixelsSrc==NULL) {
+					rowPixels[x]=(skyRowPixels!=NULL ? rendererPackedColourToPixel(skyRowPixels[backgroundColumn.skyTextureX]) : flatPixel);
+					continue;
+				}
+
+				// Sample texture and shade.
+				int textureX=std::min((int)((worldX-cellX)*textureW), textureW-1);
+				int textureY=std::min((int)((worldY-cellY)*textureH), textureH-1);
+				if (textureIndicesSrc!=NULL) {
+					rowPixels[x]=colourMap[textureIndicesSrc[textureX+textureY*textureW]];
+					continue;
+				}
+				rowPixels[x]=rendererPackedColourToPixel(texturePixelsSrc[textureX+textureY*textureW].scale(shade));
+			}
+		}
+
+		SDL_UnlockTexture(backgroundTexture);
+
+		SDL_RenderCopy(renderer, backgroundTexture, NULL, NULL);
+	}
+
+	void Renderer::drawColumns(const FrameParameters &params, bool drawZBuffer) {
+		// Opaque slices are clipped so that they do not overlap, so the order they are drawn in does not matter and we can batch them up by texture.
+		// Except if the camera is below the ground, in which case this is not true (see computeSlice), so draw each one immediately from back to front instead.
+		bool flushEachSlice=(0.5*unitBlockHeight+params.cameraZScreenAdjustment<0.0);
+
+		// Loop over each vertical slice of the screen.
+		int transparentLayers=0;
+		for(int x=0;x<renderWidth;++x)
+			transparentLayers=std::max(transparentLayers, drawColumn(params, x, drawZBuffer, flushEachSlice));
+
+		flushWallBatches();
+
+		// Draw any transparent slices over the top of what is behind them.
+		if (transparentLayers>0)
+			drawTransparentSlices(params, transparentLayers);
+	}
+
+	int Renderer::drawColumn(const FrameParameters &params, int x, bool drawZBuffer, bool flushEachSlice) {
+		const ColumnTrace &column=traces.columns[x];
+		const BlockDisplaySlice *slices=traces.slices.data()+column.slicesStart; // (not indexing, as the column may have no slices and be at the end)
+
+		// Loop over found blocks in reverse
+		int transparentCount=0;
+		size_t slicesNext=column.slicesCount;
+		while(slicesNext>0) {
+			// Adjust slicesNext now due to how it usually points one beyond last entry
+			--slicesNext;
+			const BlockDisplaySlice &slice=slices[slicesNext];
+
+			// Completely hidden?
+			if (slice.drawTop>slice.drawBottom)
+				continue;
+
+			// Draw block
+			// Transparent slices overlap those behind them so must be drawn after these - unless we are drawing each slice immediately anyway, leave them to drawTransparentSlices.
+			bool opaque=isSliceOpaque(slice);
+			if (!drawZBuffer) {
+				if (opaque || flushEachSlice)
+					addSliceQuads(params, x, slice);
+				else
+					++transparentCount;
+
+				if (flushEachSlice)
+					flushWallBatches();
+			}
+
+			// Update z-buffer for the rows we are drawing.
+			// Note: for the top of the block this is not correct - the distance should start at the one used below,
+			// but then increase up to the ray's distance at next intersection point,
+			// as calculated in ray casting step. However this should be safe for the purposes
+			// of using the z-buffer for drawing sprites, which should be above the floor/tops
+			// anyway.
+			// For transparent slices the walls only hide sprites where the texture is at least half opaque.
+			int blockDisplayTop=slice.blockDisplayBase-slice.blockDisplayHeight;
+			int wallTop=blockDisplayTop+(blockDisplayTop>params.horizonHeight ? 1 : 0);
+			int textureH=(opaque ? 0 : slice.texture->getHeight());
+			for(int y=slice.drawTop; y<=slice.drawBottom; ++y) {
+				assert(slice.distance<=zBuffer[x+y*renderWidth]);
+				if (!opaque && y>=wallTop) {
+					int textureY=std::min(((y-blockDisplayTop)*textureH)/(slice.blockDisplayHeight+1), textureH-1);
+					if (slice.texture->getPixel(slice.blockTextureX, textureY).a<128)
+						continue;
+				}
+				zBuffer[x+y*renderWidth]=slice.distance;
+			}
+		}
+
+		return transparentCount;
+	}
+
+	void Renderer::drawTransparentSlices(const FrameParameters &params, int layers) {
+		// Slices in different columns never overlap, so we can still batch these up by texture, as long as those within each column are drawn back to front.
+		// So draw in layers - the first contains the furthest transparent slice in each column, the second the next furthest, and so on.
+		transparentSliceCursors.resize(renderWidth);
+		for(int x=0; x<renderWidth; ++x)
+			transparentSliceCursors[x]=traces.columns[x].slicesCount;
+
+		for(int layer=0; layer<layers; ++layer) {
+			for(int x=0; x<renderWidth; ++x) {
+				const ColumnTrace &column=traces.columns[x];
+				const BlockDisplaySlice *slices=traces.slices.data()+column.slicesStart; // as in drawColumn
+				size_t &slicesNext=transparentSliceCursors[x];
+				while(slicesNext>0) {
+					--slicesNext;
+					const BlockDisplaySlice &slice=slices[slicesNext];
+					if (slice.drawTop<=slice.drawBottom && !isSliceOpaque(slice)) {
+						addSliceQuads(params, x, slice);
+						break;
+					}
+				}
+			}
+
+			flushWallBatches();
+		}
+	}
+
+	void Renderer::addSliceQuads(const FrameParameters &params, int x, const BlockDisplaySlice &slice) {
+		int blockDisplayTop=slice.blockDisplayBase-slice.blockDisplayHeight;
+		bool topVisible=(blockDisplayTop>params.horizonHeight);
+
+		// Walls (clipped to rows we are drawing, and leaving the top row for the block's top if visible)
+		int wallTop=std::max(blockDisplayTop+(topVisible ? 1 : 0), (int)slice.drawTop);
+		int wallBottom=slice.drawBottom;
+		if (wallTop<=wallBottom) {
+			// Add any dynamic lights, at the point where the column's ray hit the wall.
+			double wallDynamicLight=0.0;
+			if (dynamicLightTiles[x/dynamicLightTileWidth]!=0) {
+				const ColumnTrace &column=traces.columns[x];
+				double pointX=params.camera->getX()+slice.distance*column.dirX;
+				double pointY=params.camera->getY()+slice.distance*column.dirY;
+				double normalX=0.0, normalY=0.0;
+				if (slice.intersectionSide==Ray::Side::Vertical)
+					normalX=-column.stepX;
+				else
+					normalY=-column.stepY;
+				wallDynamicLight=computeDynamicLight(x, pointX, pointY, slice.blockHeight, normalX, normalY, 0.0);
+			}
+
+			if (slice.texture!=NULL) {
+				// Textured block - shading is done via the vertex colours.
+				uint8_t colourMod=255;
+				if (slice.intersectionSide==Ray::Side::Horizontal)
+					colourMod*=0.6; // make edges/corners between horizontal and vertical walls clearer
+				colourMod=std::min(colourMod*colourDistanceFactor(slice.distance)*(slice.light/255.0+wallDynamicLight), 255.0);
+				SDL_Color vertexColour={.r=colourMod, .g=colourMod, .b=colourMod, .a=255};
+
+				// Texture is stretched over the whole height of the block (including base row), so compute the section for the rows we are drawing.
+				float textureW=slice.texture->getWidth();
+				float rows=slice.blockDisplayHeight+1;
+				addWallQuad(slice.texture, x, wallTop, wallBottom, slice.blockTextureX/textureW, (slice.blockTextureX+1)/textureW, (wallTop-blockDisplayTop)/rows, (wallBottom+1-blockDisplayTop)/rows, vertexColour);
+			} else {
+				// Solid colour block
+				Colour blockDisplayColour=slice.colour;
+				if (slice.intersectionSide==Ray::Side::Horizontal)
+					blockDisplayColour.mul(0.6); // make edges/corners between horizontal and vertical walls clearer
+				blockDisplayColour.mul(colourDistanceFactor(slice.distance)*(slice.light/255.0+wallDynamicLight));
+
+				SDL_Color vertexColour={.r=blockDisplayColour.r, .g=blockDisplayColour.g, .b=blockDisplayColour.b, .a=blockDisplayColour.a};
+				addWallQuad(NULL, x, wallTop, wallBottom, 0.0, 0.0, 0.0, 0.0, vertexColour);
+			}
+		}
+
+		// Do we need to draw top of this block? (because it is below the horizon)
+		if (topVisible) {
+			int topTop=std::max(blockDisplayTop-slice.blockDisplayTopSize, (int)slice.drawTop);
+			int topBottom=std::min(blockDisplayTop, (int)slice.drawBottom);
+			if (topTop<=topBottom) {
+				Colour blockTopDisplayColour=slice.colour;
+				blockTopDisplayColour.mul(1.05);
+				double topLight=slice.topLight/255.0;
+				topLight+=computeDynamicLight(x, slice.mapX-0.5, slice.mapY-0.5, slice.blockHeight, 0.0, 0.0, 1.0); // at centre of top (note: map coordinates are offset by one, see Ray::getMapX)
+				blockTopDisplayColour.mul(colourDistanceFactor(slice.distance)*topLight); // Note: distance is not quite correct - see note in drawColumn when updating z-buffer
+
+				SDL_Color vertexColour={.r=blockTopDisplayColour.r, .g=blockTopDisplayColour.g, .b=blockTopDisplayColour.b, .a=blockTopDisplayColour.a};
+				addWallQuad(NULL, x, topTop, topBottom, 0.0, 0.0, 0.0, 0.0, vertexColour);
+			}
+		}
+	}
+
+	void Renderer::addWallQuad(Texture *texture, int x, int yTop, int yBottom, float textureX0, float textureX1, float textureY0, float textureY1, const SDL_Color &colour) {
+		if (debugView==DebugView::Overdraw)
+			for(int y=std::max(yTop, 0); y<=std::min(yBottom, renderHeight-1); ++y)
+				++debugOverdraw[x+y*renderWidth];
+
+		if (isIndexed()) {
+			drawIndexedQuad(texture, x, yTop, yBottom, textureX0, textureY0, textureY1, colour);
+			return;
+		}
+
+		// Find batch for this texture (there are usually only a handful so simply search).
+		WallBatch *batch=NULL;
+		for(auto &wallBatch : wallBatches)
+			if (wallBatch.texture==texture) {
+				batch=&wallBatch;
+				break;
+			}
+		if (batch==NULL) {
+			wallBatches.push_back(WallBatch());
+			batch=&wallBatches.back();
+			batch->texture=texture;
+		}
+
+		// Add vertices for each corner (using pixel edges, so the quad covers exactly the given pixels) and indices for the two triangles.
+		int base=batch->vertices.size();
+		float left=x, right=x+1, top=yTop, bottom=yBottom+1;
+		batch->vertices.push_back({.position={.x=left, .y=top}, .color=colour, .tex_coord={.x=textureX0, .y=textureY0}});
+		batch->vertices.push_back({.position={.x=right, .y=top}, .color=colour, .tex_coord={.x=textureX1, .y=textureY0}});
+		batch->vertices.push_back({.position={.x=left, .y=bottom}, .color=colour, .tex_coord={.x=textureX0, .y=textureY1}});
+		batch->vertices.push_back({.position={.x=right, .y=bottom}, .color=colour, .tex_coord={.x=textureX1, .y=textureY1}});
+
+		batch->indices.push_back(base+0);
+		batch->indices.push_back(base+1);
+		batch->indices.push_back(base+2);
+		batch->indices.push_back(base+2);
+		batch->indices.push_back(base+1);
+		batch->indices.push_back(base+3);
+	}
+
+	void Renderer::flushWallBatches(void) {
+		for(auto &batch : wallBatches) {
+			if (batch.indices.empty())
+				continue;
+
+			SDL_Texture *sdlTexture=(batch.texture!=NULL ? batch.texture->getSdlTexture() : NULL);
+			SDL_RenderGeometry(renderer, sdlTexture, &batch.vertices[0], batch.vertices.size(), &batch.indices[0], batch.indices.size());
+
+			batch.vertices.clear();
+			batch.indices.clear();
+		}
+	}
+
+	bool Renderer::isIndexed(void) const {
+		return (indexedFramebuffer && palette!=NULL);
+	}
+
+	void Renderer::drawBackgroundIndexed(const FrameParameters &params) {
+		const Camera &camera=*params.camera;
+
+		// Sky texture position, if any.
+		double skyTextureLeftX=0.0, skyScreenPixelsPerTexel=1.0;
+		int skyDisplayTop=0, skyDisplayHeight=1;
+		if (skyTexture!=NULL)
+			computeSkyDisplay(params, &skyTextureLeftX, &skyScreenPixelsPerTexel, &skyDisplayTop, &skyDisplayHeight);
+		const uint8_t *skyIndices=(skyTexture!=NULL && skyTexture->getPalette()==palette ? skyTexture->getPaletteIndices() : NULL);
+
+		bool floors=isDrawingFloors();
+		bool haveColumns=(floors || skyTexture!=NULL); // see drawBackground
+		double cameraX=camera.getX();
+		double cameraY=camera.getY();
+
+		// As drawBackgroundTextured, but looking up the nearest palette index for anything not already in the palette.
+		for(int y=0; y<renderHeight; ++y) {
+			uint8_t *rowPixels=&indexedPixels[y*renderWidth];
+
+			bool isGround=(y>=params.horizonHeight);
+			uint32_t flatPixel=backgroundGradientPixels[y-params.horizonHeight+backgroundGradientOffset];
+			Colour flatColour={(uint8_t)(flatPixel>>16), (uint8_t)(flatPixel>>8), (uint8_t)flatPixel, 255};
+			uint8_t flatIndex=palette->getNearestIndex(flatColour);
+
+			int skyTextureRow=-1;
+			if (!isGround && skyTexture!=NULL)
+				skyTextureRow=((y-skyDisplayTop)*skyTexture->getHeight())/skyDisplayHeight;
+
+			// Untextured rows are a flat colour (or row of the sky texture).
+			double rowOffset=y+0.5-params.horizonHeight;
+			double planeOffset=(isGround ? 0.5*unitBlockHeight : -0.5*unitBlockHeight)+params.cameraZScreenAdjustment;
+			double distance=planeOffset/rowOffset;
+			bool planeVisible=(floors && distance>0.0 && distance<camera.getMaxDist());
+			if (!planeVisible && skyTextureRow<0) {
+				memset(rowPixels, flatIndex, renderWidth);
+				continue;
+			}
+
+			double shade=(planeVisible ? colourDistanceFactor(distance) : 1.0);
+			const uint8_t *shadeMap=indexedShadeMaps[computeIndexedShadeLevel(shade)];
+			uint32_t shadeFixed=shade*256;
+
+			int cellX=INT_MIN, cellY=INT_MIN;
+			const PackedColour *texturePixelsSrc=NULL;
+			const uint8_t *textureIndicesSrc=NULL; // set if texture is quantized to our palette
+			int textureW=0, textureH=0;
+			for(int x=0; x<renderWidth; ++x) {
+				if (haveColumns && y>=backgroundColumns[x].coveredTop && y<=backgroundColumns[x].coveredBottom)
+					continue;
+
+				if (planeVisible) {
+					double worldX=cameraX+distance*backgroundColumns[x].dirX;
+					double worldY=cameraY+distance*backgroundColumns[x].dirY;
+					int pixelCellX=worldX, pixelCellY=worldY; // round towards zero and then adjust to round down (cheaper than calling floor)
+					pixelCellX-=(worldX<pixelCellX);
+					pixelCellY-=(worldY<pixelCellY);
+
+					// Entered a new cell? If so look up its textures (note: map coordinates are offset by one, see Ray::getMapX).
+					if (pixelCellX!=cellX || pixelCellY!=cellY) {
+						cellX=pixelCellX;
+						cellY=pixelCellY;
+						FloorInfo info;
+						Texture *texture=NULL;
+						if (getFloorInfoFunctor(cellX+1, cellY+1, &info, getFloorInfoUserData))
+							texture=(isGround ? info.floorTexture : info.ceilingTexture);
+						texturePixelsSrc=(texture!=NULL ? texture->getPixels() : NULL);
+						textureIndicesSrc=(texture!=NULL && texture->getPalette()==palette ? texture->getPaletteIndices() : NULL);
+						textureW=(texture!=NULL ? texture->getWidth() : 0);
+						textureH=(texture!=NULL ? texture->getHeight() : 0);
+					}
+
+					if (texturePixelsSrc!=NULL) {
+						int textureX=std::min((int)((worldX-cellX)*textureW), textureW-1);
+						int textureY=std::min((int)((worldY-cellY)*textureH), textureH-1);
+						if (textureIndicesSrc!=NULL)
+							rowPixels[x]=shadeMap[textureIndicesSrc[textureX+textureY*textureW]];
+						else
+							rowPixels[x]=palette->getNearestIndex(texturePixelsSrc[textureX+textureY*textureW].scale(shadeFixed));
+						continue;
+					}
+				}
+
+				if (skyTextureRow>=0) {
+					int skyTextureIndex=backgroundColumns[x].skyTextureX+skyTextureRow*skyTexture->getWidth();
+					rowPixels[x]=(skyIndices!=NULL ? skyIndices[skyTextureIndex] : palette->getNearestIndex(skyTexture->getPixels()[skyTextureIndex]));
+				} else
+					rowPixels[x]=flatIndex;
+			}
+		}
+	}
+
+	void Renderer::drawIndexedQuad(Texture *texture, int x, int yTop, int yBottom, float textureX, float textureY0, float textureY1, const SDL_Color &colour) {
+		int drawTop=std::max(yTop, 0), drawBottom=std::min(yBottom, renderHeight-1);
+		uint8_t *pixels=&indexedPixels[x];
+
+		// Solid colour?
+		if (texture==NULL) {
+			Colour solidColour={colour.r, colour.g, colour.b, colour.a};
+			uint8_t index=palette->getNearestIndex(solidColour);
+			for(int y=drawTop; y<=drawBottom; ++y)
+				pixels[y*renderWidth]=index;
+			return;
+		}
+
+		// Sample texture at the centre of each pixel (as when drawn as a quad), shading by the (grey) vertex colour.
+		int textureW=texture->getWidth(), textureH=texture->getHeight();
+		int texturePixelX=std::min((int)(textureX*textureW), textureW-1);
+		const PackedColour *texturePixels=texture->getPixels()+texturePixelX;
+		const uint8_t *textureIndices=(texture->getPalette()==palette ? texture->getPaletteIndices()+texturePixelX : NULL);
+		bool transparent=(texture->getTransparency()!=Texture::Transparency::None);
+		double shade=colour.r/255.0;
+		const uint8_t *shadeMap=indexedShadeMaps[computeIndexedShadeLevel(shade)];
+		uint32_t shadeFixed=(colour.r*256)/255;
+
+		double textureYStep=(textureY1-textureY0)*textureH/(yBottom-yTop+1);
+		double textureYStart=textureY0*textureH+0.5*textureYStep;
+		for(int y=drawTop; y<=drawBottom; ++y) {
+			int texturePixelY=std::max(0, std::min((int)(textureYStart+(y-yTop)*textureYStep), textureH-1));
+			int textureIndex=texturePixelY*textureW;
+			PackedColour pixel=texturePixels[textureIndex];
+			if (transparent && !pixel.isOpaque()) {
+				// Blend with existing colour and requantize.
+				if (pixel.getA()>0)
+					pixels[y*renderWidth]=palette->getNearestIndex(pixel.scale(shadeFixed).blendOver(PackedColour::fromColour(palette->getColour(pixels[y*renderWidth]))));
+			} else if (textureIndices!=NULL)
+				pixels[y*renderWidth]=shadeMap[textureIndices[textureIndex]];
+			else
+				pixels[y*renderWidth]=palette->getNearestIndex(pixel.scale(shadeFixed));
+		}
+	}
+
+	void Renderer::presentIndexedFramebuffer(const uint8_t *pixels) {
+		if (indexedTexture==NULL) {
+			indexedTexture=SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, renderWidth, renderHeight);
+			if (indexedTexture==NULL)
+				return;
+			SDL_SetTextureBlendMode(indexedTexture, SDL_BLENDMODE_NONE);
+		}
+
+		// Expand palette indices to full colour.
+		uint32_t palettePixels[Palette::size];
+		for(int i=0; i<Palette::size; ++i)
+			palettePixels[i]=rendererColourToPixel(palette->getColour(i), 255);
+
+		void *texturePixels;
+		int texturePitch;
+		if (SDL_LockTexture(indexedTexture, NULL, &texturePixels, &texturePitch)!=0)
+			return;
+		for(int y=0; y<renderHeight; ++y) {
+			uint32_t *rowPixels=(uint32_t *)(((uint8_t *)texturePixels)+y*texturePitch);
+			const uint8_t *rowIndices=pixels+y*renderWidth;
+			for(int x=0; x<renderWidth; ++x)
+				rowPixels[x]=palettePixels[rowIndices[x]];
+		}
+		SDL_UnlockTexture(indexedTexture);
+
+		SDL_RenderCopy(renderer, indexedTexture, NULL, NULL);
+	}
+
+	int Renderer::computeIndexedShadeLevel(double factor) const {
+		return std::max(0, std::min((int)(factor*(lightLevels-1)+0.5), lightLevels-1));
+	}
+
+	bool Renderer::isSliceOpaque(const BlockDisplaySlice &slice) const {
+		return (slice.texture==NULL || slice.texture->getTransparency()==Texture::Transparency::None);
+	}
+
 	int Renderer::computeBlockDisplayBase(double distance, int cameraZScreenAdjustment, int cameraPitchScreenAdjustment) {
-		int unitBlockDisplayHeight=computeBlockDisplayHeight(1.0, distance);
-		return (windowHeight+unitBlockDisplayHeight)/2+cameraZScreenAdjustment/distance+cameraPitchScreenAdjustment;
+		return computeDisplayY(0.0, distance, cameraZScreenAdjustment, cameraPitchScreenAdjustment);
+	}
+
+	int Renderer::computeBlockDisplayTop(double blockHeightFraction, double distance, int cameraZScreenAdjustment, int cameraPitchScreenAdjustment) {
+		return computeDisplayY(blockHeightFraction, distance, cameraZScreenAdjustment, cameraPitchScreenAdjustment);
 	}
 
 	int Renderer::computeBlockDisplayHeight(double blockHeightFraction, double distance) {
 		return (distance>0.0 ? (blockHeightFraction*unitBlockHeight)/distance : std::numeric_limits<double>::max());
 	}
 
+	int Renderer::computeDisplayY(double heightFraction, double distance, int cameraZScreenAdjustment, int cameraPitchScreenAdjustment) {
+		// Note: we compute this in a single step and round once, so that results are consistent as distance varies (which allows coverage tests when tracing rays).
+		// Result is clamped to keep it (and differences between two such values) within the range of an int16_t even at tiny distances.
+		const double limit=std::min(16.0*renderHeight, 16383.0);
+		double offset=((0.5-heightFraction)*unitBlockHeight+cameraZScreenAdjustment)/distance;
+		double y=floor(renderHeight/2+cameraPitchScreenAdjustment+offset);
+		return std::max(-limit, std::min(limit, y));
+	}
+
+	void Renderer::binDynamicLights(const FrameParameters &params) {
+		const Camera &camera=*params.camera;
+
+		std::fill(dynamicLightTiles.begin(), dynamicLightTiles.end(), 0);
+		frameDynamicLights.clear();
+		if (dynamicLights.empty() || dynamicLightBudget==0)
+			return;
+
+		// Find range of columns each light may reach, skipping any which are off screen.
+		for(auto &light : dynamicLights) {
+			FrameDynamicLight frameLight;
+			frameLight.light=light;
+
+			double dx=light.x-camera.getX(), dy=light.y-camera.getY();
+			double distance=sqrt(dx*dx+dy*dy);
+			if (distance<=light.radius) {
+				// Camera is within light's reach, so may be seen in any direction.
+				frameLight.key=0.0;
+				frameLight.leftX=0;
+				frameLight.rightX=renderWidth-1;
+			} else {
+				// Light reaches a circle (from above) which is seen within some angle either side of the direction to it.
+				frameLight.key=distance-light.radius;
+				double deltaAngle=angleNormalise(atan2(dy, dx)-camera.getYaw()+M_PI)-M_PI;
+				double halfAngle=asin(light.radius/distance);
+				double leftAngle=deltaAngle-halfAngle, rightAngle=deltaAngle+halfAngle;
+				if (leftAngle>=M_PI/2 || rightAngle<=-M_PI/2)
+					continue; // behind camera
+
+				// Convert angles to columns (the inverse of computeColumnAngle), clamping those beyond the sides of the view.
+				const double angleLimit=M_PI/2-1e-6;
+				frameLight.leftX=floor(renderWidth/2+tan(std::max(leftAngle, -angleLimit))*params.screenDist);
+				frameLight.rightX=ceil(renderWidth/2+tan(std::min(rightAngle, angleLimit))*params.screenDist);
+				if (frameLight.rightX<0 || frameLight.leftX>=renderWidth)
+					continue;
+				frameLight.leftX=std::max(frameLight.leftX, 0);
+				frameLight.rightX=std::min(frameLight.rightX, renderWidth-1);
+			}
+
+			frameDynamicLights.push_back(frameLight);
+		}
+
+		// Keep only the nearest lights if we have too many.
+		if (frameDynamicLights.size()>(size_t)dynamicLightBudget) {
+			std::partial_sort(frameDynamicLights.begin(), frameDynamicLights.begin()+dynamicLightBudget, frameDynamicLights.end(), RendererCompareFrameDynamicLights());
+			frameDynamicLights.resize(dynamicLightBudget);
+		}
+
+		// Add each light to the tiles it covers.
+		for(size_t i=0; i<frameDynamicLights.size(); ++i)
+			for(int tile=frameDynamicLights[i].leftX/dynamicLightTileWidth; tile<=frameDynamicLights[i].rightX/dynamicLightTileWidth; ++tile)
+				dynamicLightTiles[tile]|=(((uint32_t)1)<<i);
+	}
+
+	void Renderer::collectFrameSprites(const FrameParameters &params, const std::vector<Object *> &objects) {
+		const Camera &camera=*params.camera;
+
+		// Use camera's direction vector, so objects can be placed using dot and cross products rather than finding their bearing (as in Camera::getTargetInfo) and taking its tangent.
+		double forwardX=camera.getDirX();
+		double forwardY=camera.getDirY();
+
+		frameSprites.clear();
+		for(auto object : objects) {
+			FrameSprite sprite;
+			sprite.object=object;
+
+			// Find vector from object to camera (as in getTargetInfo), and skip if object is behind camera (or level with it).
+			const Camera &objectCamera=object->getCamera();
+			double dx=camera.getX()-objectCamera.getX();
+			double dy=camera.getY()-objectCamera.getY();
+			double forwardDot=dx*forwardX+dy*forwardY;
+			if (forwardDot>=0.0)
+				continue;
+			double forwardCross=dy*forwardX-dx*forwardY;
+
+			sprite.visibleAngle=binaryAngleAtan2(dy, dx)+binaryAngleFromRadians(objectCamera.getYaw());
+			sprite.distance=sqrt(dx*dx+dy*dy);
+
+			// Determine x-coordinate of screen where object should appear (the cross over dot product being the tangent of the bearing), and its width.
+			// Skip if zero-width or off screen (too far left or right).
+			sprite.centreScreenX=forwardCross/forwardDot*params.screenDist+renderWidth/2;
+			sprite.screenW=computeBlockDisplayHeight(object->getWidth()/renderScaleRatio, sprite.distance);
+			if (sprite.screenW<=0 || sprite.centreScreenX+sprite.screenW/2<0 || sprite.centreScreenX-sprite.screenW/2>=renderWidth)
+				continue;
+
+			// Non-negative floats compare the same as their bit patterns do as unsigned integers, so use these (inverted) as the key.
+			float distance=sprite.distance;
+			uint32_t distanceBits;
+			memcpy(&distanceBits, &distance, sizeof(distanceBits));
+			sprite.key=~distanceBits;
+
+			frameSprites.push_back(sprite);
+		}
+
+		// Sort so that we paint closer objects over the top of further away ones (the z buffer is not enough if textures are partially transparent).
+		// Objects at the same distance are left in the order given.
+		rendererSortByKey(frameSprites, frameSpritesScratch);
+	}
+
+	double Renderer::computeDynamicLight(int x, double pointX, double pointY, double pointZ, double normalX, double normalY, double normalZ) const {
+		uint32_t mask=dynamicLightTiles[x/dynamicLightTileWidth];
+		if (mask==0)
+			return 0.0;
+
+		// As with static lights (see Map::bakeLightmaps) a wall column has a single level, so each light is treated as hitting the point on the column nearest to it.
+		bool isWall=(normalZ==0.0 && (normalX!=0.0 || normalY!=0.0));
+
+		double level=0.0;
+		for(size_t i=0; i<frameDynamicLights.size(); ++i) {
+			if (!(mask&(((uint32_t)1)<<i)))
+				continue;
+
+			const DynamicLight &light=frameDynamicLights[i].light;
+			double z=(isWall ? std::max(0.0, std::min(light.z, pointZ)) : pointZ);
+			double dx=light.x-pointX, dy=light.y-pointY, dz=light.z-z;
+			double distance=sqrt(dx*dx+dy*dy+dz*dz);
+			if (distance>=light.radius)
+				continue;
+
+			double cosine=1.0;
+			if (distance>0.0 && (normalX!=0.0 || normalY!=0.0 || normalZ!=0.0))
+				cosine=(dx*normalX+dy*normalY+dz*normalZ)/distance;
+			if (cosine<=0.0)
+				continue;
+
+			level+=light.intensity*(1.0-distance/light.radius)*cosine;
+		}
+
+		return level;
+	}
+
+	void Renderer::updateColourMaps(void) {
+		if (!colourMapsDirty || palette==NULL)
+			return;
+
+		for(int level=0; level<lightLevels; ++level) {
+			double factor=brightnessMin+(((double)level)/(lightLevels-1))*(brightnessMax-brightnessMin);
+			for(int i=0; i<Palette::size; ++i) {
+				Colour colour=palette->getColour(i);
+				colour.mul(factor);
+				colourMaps[level][i]=rendererColourToPixel(colour, 255);
+
+				Colour indexedColour=palette->getColour(i);
+				indexedColour.mul(((double)level)/(lightLevels-1));
+				indexedShadeMaps[level][i]=palette->getNearestIndex(indexedColour);
+			}
+		}
+
+		colourMapsDirty=false;
+	}
+
+	int Renderer::computeLightLevel(double distance) const {
+		double distanceFactor=(distance>1.0 ? 1.0/sqrt(distance) : 1.0); // see colourDistanceFactor
+		return distanceFactor*(lightLevels-1)+0.5;
+	}
+
 	double Renderer::colourDistanceFactor(double distance) const {
 		double distanceFactor=(distance>1.0 ? 1.0/sqrt(distance) : 1.0);
 		return brightnessMin+distanceFactor*(brightnessMax-brightnessMin);
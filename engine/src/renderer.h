@@ -1,6 +1,7 @@
 #ifndef TREMORENGINE_RENDERER_H
 #define TREMORENGINE_RENDERER_H
 
+#include <cstdint>
 #include <vector>
 
 #include <SDL2/SDL.h>
@@ -9,19 +10,59 @@
 #include "camera.h"
 #include "colour.h"
 #include "object.h"
+#include "palette.h"
 #include "ray.h"
+#include "spritecache.h"
+#include "util.h"
 
 namespace TremorEngine {
 
 	class Renderer {
 	public:
+		// Faces of a block, in the order their light levels are stored in a lightmap (see BlockInfo).
+		enum class BlockFace : uint8_t {
+			MinX, // wall at the block's lowest x coordinate (facing towards negative x)
+			MaxX,
+			MinY,
+			MaxY,
+			Top,
+		};
+		static const int lightmapColumns=16; // number of light levels stored for each wall of a block, evenly spaced along it in order of increasing x (or y)
+		static const int lightmapSize=4*lightmapColumns+1; // each face's levels start at index face*lightmapColumns (so the top has just a single level, at the end)
+
 		struct BlockInfo {
 			double height;
 			Colour colour; // should always be set - used for top of block at the very least
 			Texture *texture; // texture for block walls, if NULL then colour is used instead
+			const uint8_t *lightmap; // static light levels of the block's faces (lightmapSize entries, with 255 meaning fully lit) which the usual distance shading is scaled by, if NULL then the block is fully lit
+		};
+
+		struct FloorInfo {
+			Texture *floorTexture; // texture for ground, if NULL then ground colour is used instead
+			Texture *ceilingTexture; // texture for ceiling (at unit block height), if NULL then sky colour is used instead
+		};
+
+		struct DynamicLight {
+			double x, y, z; // z is a fraction of the unit block height (as for Camera)
+			double intensity; // light level added at the light's position (where 1.0 is fully lit), decreasing linearly to zero at radius
+			double radius;
+		};
+		static const int dynamicLightBudgetMax=32;
+
+		enum class DebugView : uint8_t {
+			None,
+			Overdraw, // number of times each pixel is drawn (with the ground and sky counting once), from blue (once) to red (8 or more)
+			RaySteps, // number of cells each column's ray is stepped through this frame (so none for columns derived from others), from blue (none) to red (128 or more)
+			Slices, // number of block slices found for each column, from blue (none) to red (16 or more)
+		};
+
+		struct View {
+			const Camera *camera;
+			SDL_Rect viewport; // region of the window to draw into
 		};
 
 		typedef bool (GetBlockInfoFunctor)(int mapX, int mapY, BlockInfo *info, void *userData); // should return false if no such block
+		typedef bool (GetFloorInfoFunctor)(int mapX, int mapY, FloorInfo *info, void *userData); // should return false if cell has neither a floor nor ceiling texture
 		typedef std::vector<Object *> * (GetObjectsInRangeFunctor)(const Camera &camera, void *userData);
 
 		Renderer(SDL_Renderer *renderer, int windowWidth, int windowHeight, double unitBlockHeight, GetBlockInfoFunctor *getBlockInfoFunctor, void *getBlockInfoUserData, GetObjectsInRangeFunctor *getObjectsInRangeFunctor, void *getObjectsInRangeUserData);
@@ -34,37 +75,229 @@ namespace TremorEngine {
 		void setBrightnessMin(double value);
 		void setBrightnessMax(double value);
 
+		// Height of the tallest block (as a fraction of the unit block height) which the map contains, used to stop tracing rays once nothing further away could be visible.
+		// Default is infinity (i.e. unknown).
+		double getBlockHeightMax(void) const;
+		void setBlockHeightMax(double value);
+
 		void setGroundColour(const Colour &colour);
 		void setSkyColour(const Colour &colour);
 
+		// Sky texture - a panorama covering a full turn horizontally, with its bottom edge on the horizon, drawn instead of the sky colour.
+		// Default is NULL (i.e. use sky colour).
+		Texture *getSkyTexture(void) const;
+		void setSkyTexture(Texture *texture);
+
+		// Textured floors and ceilings - if a functor is given then the ground and sky are drawn per pixel, using any textures it returns for each cell.
+		// Default is NULL, in which case the ground and sky are simply drawn as (distance shaded) flat colours.
+		void setFloorInfoFunctor(GetFloorInfoFunctor *functor, void *userData);
+
+		// Floor time budget - if set, the time taken to draw the background with textured floors (including any sky texture) is measured each frame.
+		// If the average of recent frames goes over the budget then the ground and sky are drawn as flat colours instead (as with no functor), for floorTimeFallbackFrames frames before trying textured floors again.
+		// Default is 0 (no budget, so textured floors are always drawn however long they take).
+		static const int floorTimeFallbackFrames=60;
+		MicroSeconds getFloorTimeBudget(void) const;
+		void setFloorTimeBudget(MicroSeconds budget);
+
+		// Palette - if set, pixels of textures quantized to it are shaded with precomputed light level tables (one lookup per pixel) rather than by scaling each colour.
+		// Only used by paths which shade individual pixels (textured floors and object sprites).
+		// Default is NULL.
+		const Palette *getPalette(void) const;
+		void setPalette(const Palette *palette);
+
+		// Indexed framebuffer - if enabled (and a palette is set), the scene is rendered into a framebuffer of 8 bit palette indices, shading with tables mapping each index to the nearest palette entry at each light level.
+		// Only at the end of the frame is it expanded to full colour, to be uploaded and drawn.
+		// Textures quantized to the palette are drawn directly from their indices, others are converted pixel by pixel.
+		// Partially transparent pixels are blended over the palette colour already in the framebuffer, with the result requantized to the nearest palette entry (so repeated blending may drift from the full colour result).
+		// Default is disabled.
+		bool getIndexedFramebuffer(void) const;
+		void setIndexedFramebuffer(bool value);
+
+		// Sprite cache - if given a budget (in bytes), object sprites drawn smaller than their texture are read from copies pre-scaled to (roughly) their screen size, rather than from the full size texture.
+		// Default is 0 (disabled). clearSpriteCache must be called if any object texture is modified or freed while enabled.
+		size_t getSpriteCacheBudget(void) const;
+		void setSpriteCacheBudget(size_t bytes);
+		void clearSpriteCache(void);
+
+		// Dynamic lights - added on top of any static lighting (see BlockInfo) for block walls, block tops and object sprites, but without shadows.
+		// Each frame the lights are binned into tiles of screen columns based on their projected extent, so only lights which may reach a column are evaluated for it.
+		// Lights are kept until cleared, so moving lights should be cleared and re-added each frame.
+		// If more than the budget could be visible then only the nearest are used.
+		void clearDynamicLights(void);
+		void addDynamicLight(const DynamicLight &light);
+		int getDynamicLightBudget(void) const; // default 8
+		void setDynamicLightBudget(int value); // at most dynamicLightBudgetMax
+
+		// Column interpolation - only every n-th screen column has a ray fully traced through the map.
+		// Columns in between are derived directly from the two traced either side of them, if these took exactly the same path through the grid (in which case every ray between them must do so too, so the result is identical).
+		// Otherwise we fall back to tracing more columns in between.
+		// Default value is 1, which traces every column (i.e. disables interpolation).
+		int getColumnInterpolationStride(void) const;
+		void setColumnInterpolationStride(int value);
+
+		// Temporal column reuse - when the camera has not moved since the previous frame (e.g. only turned), columns are derived from the previous frame's rays either side of the same absolute angle, in the same way as interpolation above.
+		// Only newly exposed columns, or those next to a change in path, are traced again.
+		// Default is disabled. If enabled, invalidateBlock must be called whenever a block is added, removed or changed between frames.
+		bool getTemporalColumnReuse(void) const;
+		void setTemporalColumnReuse(bool value);
+
+		// Render resolution - the scene can be rendered at a fraction of the window's size (independently for width, which sets the number of rays traced, and height) and then scaled up to fill the window.
+		// Scales should be in interval (0.0,1.0], default is 1.0 for both (i.e. render directly to the window).
+		double getRenderScaleX(void) const;
+		double getRenderScaleY(void) const;
+		bool setRenderScale(double scaleX, double scaleY); // returns false on failure (e.g. could not allocate buffers)
+
+		// Adaptive resolution - if a frame time target is set, the render scale is adjusted after each frame to keep the time taken by render within it, based on the average of recent frames.
+		// Both scales are set to the same value, kept within [minScale,1.0].
+		// Default target is 0 (disabled, leaving the scale as set by setRenderScale).
+		MicroSeconds getFrameTimeTarget(void) const;
+		void setFrameTimeTarget(MicroSeconds target, double minScale=0.5);
+
+		void invalidateBlock(int mapX, int mapY); // call if a block has changed since the last frame was rendered, to discard any cached results which may depend on it
+
 		void render(const Camera &camera, bool drawZBuffer); // if drawZBuffer is true then all standard rendering logic is carried out, and then at the very end we draw a heatmap of the z-buffer over the top
 		void renderTopDown(const Camera &camera);
 
+		// Debug views - if set, the frame is replaced by a heatmap showing how much work went into each pixel or column (ignored if drawZBuffer is passed to render).
+		// Default is DebugView::None.
+		DebugView getDebugView(void) const;
+		void setDebugView(DebugView value);
+
+		// Multiple views - draws several cameras into separate regions of the window (e.g. for split screen), sharing work where possible.
+		// Objects are queried once (using the first view's camera), shading tables are computed once, and each view's rays are traced in parallel before they are drawn in turn.
+		// Each view keeps its own state between calls (e.g. for temporal column reuse), so views should be given in the same order every frame.
+		// Settings and render scale are taken from this renderer, with any frame time target applying to the call as a whole.
+		void renderViews(const View *views, size_t count, bool drawZBuffer);
+
+		// Pipelined rendering - as render, but draws the frame rendered by the previous call, while rendering the next one on another thread at the same time.
+		// Only applies when using the indexed framebuffer (see setIndexedFramebuffer) without a debug view, as then everything up to the final expansion and upload is done on the CPU - otherwise this is the same as render.
+		// At most one frame is ever waiting to be drawn, so the image lags the camera by one call (the first call, or the first after a change which discards the waiting frame, draws its own frame straight away).
+		// Objects and blocks are only read during the call, so may be modified between calls as usual.
+		void renderPipelined(const Camera &camera);
+
 	private:
+		struct FrameParameters {
+			const Camera *camera;
+			double screenDist;
+			int cameraZScreenAdjustment;
+			int cameraPitchScreenAdjustment;
+			int horizonHeight;
+		};
+
 		struct BlockDisplaySlice {
-			double distance;
+			// Note: a slice is stored for every block hit in every column each frame, so this is kept compact (with screen values limited to int16_t by computeDisplayY).
+			Texture *texture; // block's texture, if NULL then colour is used for walls instead
+			float distance;
+			float blockHeight; // as a fraction of unitBlockHeight
+
+			int mapX, mapY;
+
+			int16_t blockDisplayBase;
+			int16_t blockDisplayHeight;
+
+			int16_t blockDisplayTopSize; // only defined if top is visible
+
+			int16_t blockTextureX; // only defined if texture!=NULL
+
+			// Rows this slice is drawn to - clipped to the screen and to rows not already covered by nearer slices, so (when the camera is above the ground) opaque slices in the same column never overlap.
+			// Note: rows of transparent slices (see isSliceOpaque) are not considered covered, except for the block's top, so further slices may be drawn beneath them.
+			// If drawTop>drawBottom then the slice is completely hidden.
+			int16_t drawTop, drawBottom;
+
+			uint8_t light; // light level of the wall column hit, taken from the block's lightmap (255 if none)
+			uint8_t topLight; // light level of the block's top, as above
+
+			Colour colour;
 			Ray::Side intersectionSide;
+		};
 
-			int blockDisplayBase;
-			int blockDisplayHeight;
+		struct ColumnTrace {
+			bool ready; // true once the column has been traced (or derived) for the current frame - or, for the previous frame, false if the results have since been invalidated
 
-			int blockDisplayTopSize; // only defined if top is visible
+			double angle; // absolute angle of ray cast for this column
+			double dirX, dirY; // unit vector of the same ray (see Camera::getColumnDirection)
 
-			int blockTextureX; // only defined if block's texture!=NULL
+			size_t slicesStart, slicesCount; // slices hit, nearest first, as indexes into ColumnTraces::slices
 
-			BlockInfo blockInfo;
+			int stepX, stepY; // direction ray moves in each axis (see Ray::getStepX/Y)
+			size_t stepsStart; // offset into ColumnTraces::steps
+			size_t stepsCount; // number of times the ray was advanced, each represented by one bit (set for a vertical side crossing, clear for horizontal)
+			size_t stepsTraced; // number of those steps actually carried out this frame, 0 if the column was derived from others (for DebugView::RaySteps)
+
+			bool occluded; // true if the ray stopped because the column was covered after the last slice, otherwise stopped due to reaching camera's max distance
+			int endMapX, endMapY; // ray position when tracing stopped
+			Ray::Side endSide;
+		};
+
+		struct WallBatch {
+			Texture *texture; // NULL for solid colour walls and block tops
+			std::vector<SDL_Vertex> vertices; // four per quad
+			std::vector<int> indices; // six per quad (two triangles)
+		};
+
+		struct FrameDynamicLight {
+			DynamicLight light;
+			double key; // sort key - distance from camera to the nearest point the light reaches
+			int leftX, rightX; // range of screen columns the light may reach
+		};
+
+		struct FrameSprite {
+			Object *object;
+			BinaryAngle visibleAngle; // angle the object is seen from, for choosing its texture
+			double distance;
+			int centreScreenX, screenW; // horizontal extent on screen (at least partially visible)
+			uint32_t key; // sort key - decreases with distance (the bits of the float distance inverted), so sorting in ascending order puts the furthest first
+		};
+
+		struct ColumnCoverage {
+			// Interval of rows which may still be drawn over by further away slices - any rows outside of this are either already covered by nearer slices, or cannot be reached by any further slices.
+			// Once this is empty there is no point tracing the column's ray any further.
+			int top, bottom;
+		};
+
+		struct BackgroundColumn {
+			double dirX, dirY; // unit vector of column's ray
+			int coveredTop, coveredBottom; // rows which are drawn over by the column's nearest block anyway (empty interval if none)
+			int skyTextureX; // column of sky texture seen in this column (if any)
+		};
+
+		struct ColumnTraces {
+			double cameraX, cameraY, cameraMaxDist; // the rays' origin and length, which must match in order to reuse these results in the next frame
+
+			std::vector<ColumnTrace> columns; // renderWidth entries
+			// Note: these are cleared rather than freed between frames, so after the first few frames no allocations are needed.
+			std::vector<BlockDisplaySlice> slices; // all columns' slices, grows as needed so there is no limit on the number of slices per column
+			std::vector<uint32_t> steps;
 		};
 
 		SDL_Renderer *renderer;
 		int windowWidth;
 		int windowHeight;
-		double unitBlockHeight; // increasing this will stretch blocks to be larger vertically relative to their width, decreasing will shrink them
+		double windowUnitBlockHeight; // increasing this will stretch blocks to be larger vertically relative to their width, decreasing will shrink them
+
+		// Size we actually render at (see setRenderScale), everything below is in terms of this rather than the window's size.
+		int renderWidth;
+		int renderHeight;
+		double unitBlockHeight; // windowUnitBlockHeight scaled to the render height
+		double renderScaleRatio; // ratio of vertical to horizontal render scale, 1.0 unless scaled unevenly
+		SDL_Texture *renderTexture; // target we render to if not the window's size, created on first use
+
+		MicroSeconds frameTimeTarget;
+		double frameTimeMinScale;
+		double frameTimeAverage; // recent time taken by render, in microseconds
+		int frameTimeSettleFrames; // frames to wait after changing scale before adjusting again
 		GetBlockInfoFunctor *getBlockInfoFunctor;
 		void *getBlockInfoUserData;
 		GetObjectsInRangeFunctor *getObjectsInRangeFunctor;
 		void *getObjectsInRangeUserData;
+		GetFloorInfoFunctor *getFloorInfoFunctor;
+		void *getFloorInfoUserData;
+		MicroSeconds floorTimeBudget;
+		double floorTimeAverage; // recent time taken to draw background with textured floors, in microseconds
+		int floorTimeFallbackFramesLeft; // if non-zero then textured floors are over budget, so are not drawn for this many more frames
 
 		Colour colourBg, colourGround, colourSky;
+		Texture *skyTexture;
 
 		// These values control the brightness levels.
 		// Default values are (min,max)=(0.0,1.0).
@@ -73,11 +306,122 @@ namespace TremorEngine {
 		// bright space - (0.5,1.0)
 		double brightnessMin, brightnessMax;
 
-		double *zBuffer; // windowWidth*windowHeight number of entries
+		double blockHeightMax;
+
+		static const int lightLevels=32;
+		const Palette *palette;
+		bool colourMapsDirty;
+		uint8_t indexedShadeMaps[lightLevels][Palette::size]; // for indexed framebuffer, nearest palette index to each entry scaled by level/(lightLevels-1) (note: unlike colourMaps this does not depend on brightness)
+		uint32_t colourMaps[lightLevels][Palette::size]; // shaded colour of each palette entry (in SDL_PIXELFORMAT_ARGB8888 format, with full alpha) at each light level
+
+		double *zBuffer; // renderWidth*renderHeight number of entries
+
+		static const int dynamicLightTileWidth=16; // in screen columns
+		std::vector<DynamicLight> dynamicLights;
+		int dynamicLightBudget;
+		std::vector<FrameDynamicLight> frameDynamicLights; // lights used in the current frame (at most dynamicLightBudget), indexed by bits of dynamicLightTiles
+		std::vector<uint32_t> dynamicLightTiles; // for each tile of screen columns, bitset of frameDynamicLights which may reach it
+
+		// Flat ground and sky colours only depend on the row's offset from the horizon (and the colours and brightness), so are computed once into a gradient covering any possible horizon height.
+		// This is drawn with a single copy each frame (with offset based on the horizon), and rebuilt only if any of the above change.
+		bool backgroundGradientDirty;
+		int backgroundGradientOffset; // index of the horizon row in the gradient (such that the row for screen row y is y-horizonHeight+backgroundGradientOffset)
+		int backgroundGradientHeight; // number of rows in the gradient
+		std::vector<uint32_t> backgroundGradientPixels; // backgroundGradientHeight entries (in SDL_PIXELFORMAT_ARGB8888 format)
+		SDL_Texture *backgroundGradientTexture; // 1 pixel wide copy of the above
+
+		SDL_Texture *backgroundTexture; // streaming texture the ground and sky are drawn into when using textured floors, created on first use
+		std::vector<BackgroundColumn> backgroundColumns; // renderWidth entries
+
+		int columnInterpolationStride;
+		bool temporalColumnReuse;
+		ColumnTraces traces; // results of tracing rays for each column in the current frame
+		ColumnTraces prevTraces; // results from the previous frame (swapped with the above each frame to avoid reallocating)
+
+		// Block walls and tops are collected into one batch per texture and then drawn with a single call each.
+		std::vector<WallBatch> wallBatches; // kept between frames to avoid reallocating
+		std::vector<size_t> transparentSliceCursors; // renderWidth entries, used by drawTransparentSlices
+
+		std::vector<FrameSprite> frameSprites; // objects to draw in the current frame, furthest first
+		std::vector<FrameSprite> frameSpritesScratch; // used when sorting the above
+		SpriteCache spriteCache;
+
+		bool indexedFramebuffer;
+		std::vector<uint8_t> indexedPixels; // renderWidth*renderHeight palette indices
+		std::vector<uint8_t> pipelinePixels; // as indexedPixels, frame rendered by the last renderPipelined call waiting to be drawn by the next (swapped with indexedPixels each call)
+		bool pipelineFrameReady; // true if pipelinePixels holds a frame still to be drawn
+		SDL_Texture *indexedTexture; // streaming texture indexedPixels are expanded into, created on first use
+
+		DebugView debugView;
+		std::vector<uint16_t> debugOverdraw; // renderWidth*renderHeight entries, only updated if debugView is DebugView::Overdraw
+		std::vector<uint32_t> debugPixels; // heatmap to be uploaded to debugTexture (in SDL_PIXELFORMAT_ARGB8888 format)
+		SDL_Texture *debugTexture; // streaming texture, created on first use
+
+		// renderTopDown draws blocks and grid lines into a cached texture, covering a range of cells around those last visible.
+		static const int topDownCellSize=16; // in pixels
+		SDL_Texture *topDownTexture; // created on first use
+		bool topDownDirty; // set if a block within the range has changed
+		int topDownMinMapX, topDownMinMapY, topDownMaxMapX, topDownMaxMapY; // range of cells covered by topDownTexture (inclusive)
+
+		Renderer *viewParent; // renderer this is a view of (see renderViews), otherwise NULL
+		std::vector<Renderer *> viewRenderers; // one per view rendered by renderViews, created as needed
+
+		bool resizeRender(int width, int height); // reallocates everything which depends on the render size
+		void updateFrameTime(MicroSeconds frameTime); // adjusts render scale for frame time target, if any
+		bool isDrawingFloors(void) const; // true if drawing textured floors this frame (i.e. a functor is set and they are not over budget)
+		void updateFloorTime(MicroSeconds floorTime); // checks floor time budget, if any - floorTime is the time taken to draw the background, or 0 if textured floors were not drawn
+
+		bool updateTopDownTexture(int minMapX, int minMapY, int maxMapX, int maxMapY); // redraws topDownTexture to cover the given range of cells, returns false on failure
+
+		void prepareFrame(const Camera &camera, const std::vector<Object *> &objects, FrameParameters &params); // everything before drawing which does not need SDL (so can run in parallel for separate views)
+		void drawFrame(const FrameParameters &params, bool drawZBuffer); // requires prepareFrame
+		void drawScene(const FrameParameters &params, bool drawZBuffer); // background, blocks and sprites - part of drawFrame which, if drawing indexed, does not call SDL (once updateBackgroundGradient has been)
+		void updateViewRenderer(Renderer *view); // copies settings to one of viewRenderers
+		void drawDebugView(bool drawZBuffer); // draws z-buffer or debugView heatmap over the whole frame
+		bool isIndexed(void) const; // true if drawing to indexedPixels this frame
+		void drawBackgroundIndexed(const FrameParameters &params); // as drawBackgroundTextured but into indexedPixels, also covering flat and sky only backgrounds
+		void drawIndexedQuad(Texture *texture, int x, int yTop, int yBottom, float textureX, float textureY0, float textureY1, const SDL_Color &colour); // as addWallQuad but drawn immediately into indexedPixels
+		void presentIndexedFramebuffer(const uint8_t *pixels); // expands renderWidth*renderHeight palette indices to full colour and draws them
+		int computeIndexedShadeLevel(double factor) const; // index into indexedShadeMaps, factor is clamped to [0,1]
+
+		void traceColumns(const FrameParameters &params);
+		void traceColumnsBetween(const FrameParameters &params, int leftX, int rightX); // assumes columns leftX and rightX are already ready
+		void reuseColumns(const FrameParameters &params); // attempts to derive each column from prevTraces
+		void resolveColumn(const FrameParameters &params, int x); // traces column unless it is already ready
+		void traceColumn(const FrameParameters &params, int x);
+		bool deriveColumn(const FrameParameters &params, int x, const ColumnTraces &source, const ColumnTrace &neighbour); // neighbour is from source (either traces or prevTraces), and must share its path with the column on the other side of x (see compareColumnPaths) - returns false if cannot be done exactly, in which case column x should be traced instead
+		bool computeSlice(const FrameParameters &params, ColumnCoverage &coverage, Ray &ray, const uint8_t *lightmap, BlockDisplaySlice &slice); // ray should be at the intersection with the slice's block, and is advanced to the next intersection, lightmap is as in BlockInfo - returns true if the column is now fully covered
+		void pushColumnStep(ColumnTrace &column, Ray::Side side);
+		bool compareColumnPaths(const ColumnTraces &source, const ColumnTrace &a, const ColumnTrace &b) const; // true if both rays passed through exactly the same sequence of cells and stopped for the same reason
+		double computeColumnAngle(const FrameParameters &params, int x) const;
+
+		bool updateBackgroundGradient(void); // rebuilds gradient if needed, returns false on failure
+		void computeBackgroundColumns(const FrameParameters &params); // requires columns to have been traced
+		void computeSkyDisplay(const FrameParameters &params, double *textureLeftX, double *screenPixelsPerTexel, int *displayTop, int *displayHeight) const; // requires skyTexture to be set
+		void drawBackground(const FrameParameters &params); // requires columns to have been traced
+		void drawBackgroundTextured(const FrameParameters &params); // requires backgroundColumns to have been computed
+		void drawSky(const FrameParameters &params); // requires backgroundColumns to have been computed
+		void drawColumns(const FrameParameters &params, bool drawZBuffer);
+		int drawColumn(const FrameParameters &params, int x, bool drawZBuffer, bool flushEachSlice); // returns number of transparent slices left to be drawn by drawTransparentSlices
+		void drawTransparentSlices(const FrameParameters &params, int layers); // layers is the most transparent slices left in any column
+		void addSliceQuads(const FrameParameters &params, int x, const BlockDisplaySlice &slice);
+		void addWallQuad(Texture *texture, int x, int yTop, int yBottom, float textureX0, float textureX1, float textureY0, float textureY1, const SDL_Color &colour); // covers rows yTop to yBottom inclusive, texture coordinates are normalised
+		void flushWallBatches(void);
+
+		bool isSliceOpaque(const BlockDisplaySlice &slice) const; // true unless the slice's texture has any transparency
 
 		int computeBlockDisplayBase(double distance, int cameraZScreenAdjustment, int cameraPitchScreenAdjustment);
+		int computeBlockDisplayTop(double blockHeightFraction, double distance, int cameraZScreenAdjustment, int cameraPitchScreenAdjustment);
 		int computeBlockDisplayHeight(double blockHeightFraction, double distance);
+		int computeDisplayY(double heightFraction, double distance, int cameraZScreenAdjustment, int cameraPitchScreenAdjustment); // screen row for a point at the given height, rounded down (so never decreases as distance increases if the point is below the camera, and never increases if above)
+
+		void binDynamicLights(const FrameParameters &params); // computes frameDynamicLights and dynamicLightTiles
+		double computeDynamicLight(int x, double pointX, double pointY, double pointZ, double normalX, double normalY, double normalZ) const; // light level added by dynamic lights to a point seen in screen column x - zero normal means the point faces every direction, and for walls (zero normalZ) pointZ should be the block's height
+
+		void collectFrameSprites(const FrameParameters &params, const std::vector<Object *> &objects); // computes frameSprites, culling any which cannot be seen
 
+		void updateColourMaps(void); // rebuilds colourMaps if needed
+		int computeLightLevel(double distance) const; // index into colourMaps, equivalent to colourDistanceFactor
 		double colourDistanceFactor(double distance) const ;
 		void colourAdjustForDistance(Colour &colour, double distance) const ;
 	};
@@ -0,0 +1,140 @@
+#include <cassert>
+#include <cstdlib>
+
+#include "spritecache.h"
+
+namespace TremorEngine {
+	SpriteCache::SpriteCache(void) {
+		budget=0;
+		size=0;
+	}
+
+	SpriteCache::~SpriteCache() {
+		clear();
+	}
+
+	size_t SpriteCache::getBudget(void) const {
+		return budget;
+	}
+
+	void SpriteCache::setBudget(size_t bytes) {
+		budget=bytes;
+		evict(0);
+	}
+
+	size_t SpriteCache::getSize(void) const {
+		return size;
+	}
+
+	void SpriteCache::clear(void) {
+		for(auto &entry : entries)
+			freeEntry(entry);
+		entries.clear();
+		lookup.clear();
+		size=0;
+	}
+
+	int SpriteCache::quantizeSize(int size, int textureSize) {
+		if (size>=textureSize)
+			return textureSize;
+
+		int shift=0;
+		while((size>>shift)>=8)
+			++shift;
+		int quantized=((size+(1<<shift)-1)>>shift)<<shift;
+
+		return (quantized<textureSize ? quantized : textureSize);
+	}
+
+	bool SpriteCache::getImage(const Texture *texture, int width, int height, Image *image) {
+		assert(texture!=NULL);
+		assert(width>0 && width<=texture->getWidth());
+		assert(height>0 && height<=texture->getHeight());
+		assert(image!=NULL);
+
+		Key key;
+		key.texture=texture;
+		key.width=width;
+		key.height=height;
+
+		// Look for existing entry - if found but created before the texture was (re)quantized then discard it.
+		auto found=lookup.find(key);
+		if (found!=lookup.end()) {
+			auto entryIter=found->second;
+			if (entryIter->palette==texture->getPalette()) {
+				entries.splice(entries.begin(), entries, entryIter); // mark as most recently used
+				image->width=width;
+				image->height=height;
+				image->pixels=entryIter->pixels;
+				image->paletteIndices=entryIter->paletteIndices;
+				return true;
+			}
+
+			size-=entryIter->bytes;
+			freeEntry(*entryIter);
+			entries.erase(entryIter);
+			lookup.erase(found);
+		}
+
+		// Make room for new entry.
+		const uint8_t *textureIndices=texture->getPaletteIndices();
+		size_t bytes=((size_t)width)*height*(sizeof(PackedColour)+(textureIndices!=NULL ? 1 : 0));
+		if (bytes>budget)
+			return false;
+		evict(bytes);
+
+		// Create new entry, sampling texture in the same way as when drawing sprites directly from it.
+		Entry entry;
+		entry.key=key;
+		entry.palette=texture->getPalette();
+		entry.pixels=(PackedColour *)malloc(sizeof(PackedColour)*width*height);
+		entry.paletteIndices=(textureIndices!=NULL ? (uint8_t *)malloc(width*height) : NULL);
+		entry.bytes=bytes;
+		if (entry.pixels==NULL || (textureIndices!=NULL && entry.paletteIndices==NULL)) {
+			freeEntry(entry);
+			return false;
+		}
+
+		const PackedColour *texturePixels=texture->getPixels();
+		int textureWidth=texture->getWidth();
+		double textureXFactor=((double)textureWidth)/width;
+		double textureYFactor=((double)texture->getHeight())/height;
+		for(int y=0; y<height; ++y) {
+			int textureY=y*textureYFactor;
+			for(int x=0; x<width; ++x) {
+				int textureX=x*textureXFactor;
+				entry.pixels[x+y*width]=texturePixels[textureX+textureY*textureWidth];
+				if (textureIndices!=NULL)
+					entry.paletteIndices[x+y*width]=textureIndices[textureX+textureY*textureWidth];
+			}
+		}
+
+		entries.push_front(entry);
+		lookup[key]=entries.begin();
+		size+=bytes;
+
+		image->width=width;
+		image->height=height;
+		image->pixels=entry.pixels;
+		image->paletteIndices=entry.paletteIndices;
+
+		return true;
+	}
+
+	void SpriteCache::evict(size_t bytes) {
+		while(!entries.empty() && size+bytes>budget) {
+			Entry &entry=entries.back();
+			size-=entry.bytes;
+			lookup.erase(entry.key);
+			freeEntry(entry);
+			entries.pop_back();
+		}
+	}
+
+	void SpriteCache::freeEntry(Entry &entry) {
+		free(entry.pixels);
+		entry.pixels=NULL;
+		free(entry.paletteIndices);
+		entry.paletteIndices=NULL;
+	}
+};
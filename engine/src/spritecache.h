@@ -0,0 +1,77 @@
+#ifndef TREMORENGINE_SPRITECACHE_H
+#define TREMORENGINE_SPRITECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+#include "colour.h"
+#include "palette.h"
+#include "texture.h"
+
+namespace TremorEngine {
+
+	// Cache of textures pre-scaled down to (roughly) the size they are drawn at, so that small distant sprites read from small images rather than striding through large source textures.
+	// Images are kept in buckets of quantized size, and the least recently used are evicted to stay within a memory budget.
+	class SpriteCache {
+	public:
+		struct Image {
+			int width, height;
+			const PackedColour *pixels; // width*height entries, row by row
+			const uint8_t *paletteIndices; // as above, NULL unless the source texture is quantized to a palette
+		};
+
+		SpriteCache(void);
+		~SpriteCache();
+
+		size_t getBudget(void) const; // in bytes, default is 0 (in which case nothing is cached)
+		void setBudget(size_t bytes); // evicts images if needed
+		size_t getSize(void) const; // bytes currently used
+
+		void clear(void); // must be called if any texture with cached images is modified or freed
+
+		static int quantizeSize(int size, int textureSize); // rounds size up to a bucket size (keeping only the three most significant bits), never exceeding textureSize
+
+		// Returns an image of the texture scaled to the given (quantized) size, creating it if needed.
+		// The image remains valid until the next call to getImage, setBudget or clear.
+		// Returns false if the image does not fit within the budget or on allocation failure.
+		bool getImage(const Texture *texture, int width, int height, Image *image);
+
+	private:
+		struct Key {
+			const Texture *texture;
+			int width, height;
+
+			bool operator==(const Key &other) const {
+				return (texture==other.texture && width==other.width && height==other.height);
+			}
+		};
+
+		struct KeyHash {
+			size_t operator()(const Key &key) const {
+				return std::hash<const void *>()(key.texture)^(((size_t)key.width)*0x9E3779B1u)^(((size_t)key.height)<<16);
+			}
+		};
+
+		struct Entry {
+			Key key;
+			const Palette *palette; // texture's palette when created, so indices can be rebuilt if it is quantized again
+			PackedColour *pixels;
+			uint8_t *paletteIndices;
+			size_t bytes;
+		};
+
+		size_t budget, size;
+
+		std::list<Entry> entries; // most recently used first
+		std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> lookup;
+
+		void evict(size_t bytes); // frees least recently used entries until size+bytes fits within the budget
+		void freeEntry(Entry &entry);
+	};
+
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <cassert>
 #include <cstdlib>
 
+#include "palette.h"
 #include "texture.h"
 
 namespace TremorEngine {
@@ -8,6 +9,8 @@ namespace TremorEngine {
 		// Set fields to indicate not initialised
 		hasInit=false;
 		texture=NULL;
+		palette=NULL;
+		paletteIndices=NULL;
 
 		// Load surface and texture
 		SDL_Surface *surface=IMG_Load(path);
@@ -23,23 +26,32 @@ namespace TremorEngine {
 		SDL_QueryTexture(texture, NULL, NULL, &width, &height);
 
 		// Allocate pixels array
-		pixels=(Colour *)malloc(sizeof(Colour)*width*height);
+		pixels=(PackedColour *)malloc(sizeof(PackedColour)*width*height);
 		if (pixels==NULL) {
 			SDL_FreeSurface(surface);
 			return;
 		}
 
-		// Fill pixels array
+		// Fill pixels array, noting how transparent the texture is
 		SDL_LockSurface(surface);
 
-		Colour *destPixelPtr=pixels;
+		transparency=Transparency::None;
+
+		PackedColour *destPixelPtr=pixels;
 		uint8_t *srcPixelPtr=(uint8_t *)surface->pixels;
 		for(unsigned i=0; i<height; ++i)
 			for(unsigned j=0; j<width; ++j) {
 				uint32_t pixel;
 				memcpy(&pixel, srcPixelPtr, surface->format->BytesPerPixel);
 
-				SDL_GetRGBA(pixel, surface->format, &(destPixelPtr->r), &(destPixelPtr->g), &(destPixelPtr->b), &(destPixelPtr->a));
+				Colour colour;
+				SDL_GetRGBA(pixel, surface->format, &colour.r, &colour.g, &colour.b, &colour.a);
+				*destPixelPtr=PackedColour::fromColour(colour);
+
+				if (colour.a==0 && transparency==Transparency::None)
+					transparency=Transparency::Binary;
+				else if (colour.a>0 && colour.a<255)
+					transparency=Transparency::Partial;
 
 				srcPixelPtr+=surface->format->BytesPerPixel;
 				++destPixelPtr;
@@ -60,6 +72,7 @@ namespace TremorEngine {
 
 		SDL_DestroyTexture(texture);
 		free(pixels);
+		free(paletteIndices);
 	}
 
 	bool Texture::getHasInit(void) const {
@@ -78,7 +91,44 @@ namespace TremorEngine {
 		assert(x>=0 && x<getWidth());
 		assert(y>=0 && y<getHeight());
 
-		return pixels[x+y*getWidth()];
+		return pixels[x+y*getWidth()].toColour();
+	}
+
+	const PackedColour *Texture::getPixels(void) const {
+		return pixels;
+	}
+
+	Texture::Transparency Texture::getTransparency(void) const {
+		return transparency;
+	}
+
+	bool Texture::quantize(const Palette *newPalette) {
+		assert(newPalette!=NULL);
+
+		if (!hasInit)
+			return false;
+
+		// Allocate indices array if needed
+		if (paletteIndices==NULL) {
+			paletteIndices=(uint8_t *)malloc(width*height);
+			if (paletteIndices==NULL)
+				return false;
+		}
+
+		// Find nearest palette entry for each pixel
+		for(int i=0; i<width*height; ++i)
+			paletteIndices[i]=newPalette->getNearestIndex(pixels[i].toColour());
+		palette=newPalette;
+
+		return true;
+	}
+
+	const Palette *Texture::getPalette(void) const {
+		return palette;
+	}
+
+	const uint8_t *Texture::getPaletteIndices(void) const {
+		return paletteIndices;
 	}
 
 	SDL_Texture *Texture::getSdlTexture(void) const {
@@ -7,9 +7,16 @@
 #include "colour.h"
 
 namespace TremorEngine {
+	class Palette;
 
 	class Texture {
 	public:
+		enum class Transparency : uint8_t {
+			None, // every pixel is fully opaque
+			Binary, // every pixel is either fully opaque or fully transparent (i.e. can be alpha tested)
+			Partial, // some pixels are partially transparent (i.e. need alpha blending)
+		};
+
 		Texture(SDL_Renderer *renderer, const char *file); // check getHasInit after calling
 		~Texture();
 
@@ -18,6 +25,14 @@ namespace TremorEngine {
 		int getWidth(void) const;
 		int getHeight(void) const;
 		Colour getPixel(int x, int y) const;
+		const PackedColour *getPixels(void) const; // width*height entries, row by row (note: premultiplied, see PackedColour)
+
+		Transparency getTransparency(void) const; // found by scanning pixels' alpha values when loaded
+
+		// Palette quantization - once quantized the pixels are also available as indexes into the palette (the original pixels are kept, including alpha).
+		bool quantize(const Palette *palette); // palette must remain valid for the lifetime of the texture, or until quantized again
+		const Palette *getPalette(void) const; // NULL if not quantized
+		const uint8_t *getPaletteIndices(void) const; // width*height entries, row by row - NULL if not quantized
 
 		SDL_Texture *getSdlTexture(void) const;
 	private:
@@ -27,7 +42,12 @@ namespace TremorEngine {
 
 		SDL_Texture *texture;
 
-		Colour *pixels;
+		PackedColour *pixels;
+
+		Transparency transparency;
+
+		const Palette *palette;
+		uint8_t *paletteIndices;
 	};
 
 };
@@ -28,6 +28,46 @@ namespace TremorEngine {
 		return angle;
 	}
 
+	struct UtilAtanTable {
+		static const int size=1024;
+		float values[size+1]; // atan(i/size) in binary angle units
+
+		UtilAtanTable() {
+			for(int i=0; i<=size; ++i)
+				values[i]=atan(((double)i)/size)*binaryAngleFullTurn/(2.0*M_PI);
+		}
+	};
+	static const UtilAtanTable utilAtanTable;
+
+	BinaryAngle binaryAngleFromRadians(double angle) {
+		double units=angle*(binaryAngleFullTurn/(2.0*M_PI));
+		return (BinaryAngle)(long long)(units>=0.0 ? units+0.5 : units-0.5); // conversion to unsigned type wraps
+	}
+
+	double binaryAngleToRadians(BinaryAngle angle) {
+		return angle*(2.0*M_PI/binaryAngleFullTurn);
+	}
+
+	BinaryAngle binaryAngleAtan2(double y, double x) {
+		// Reduce to the first octant, so the ratio is in [0,1], and interpolate between table entries.
+		// (the error from interpolating is below 1e-6 units, so the result is within rounding of the exact angle)
+		double absX=fabs(x), absY=fabs(y);
+		if (absX==0.0 && absY==0.0)
+			return 0;
+		bool steep=(absY>absX);
+		double ratio=(steep ? absX/absY : absY/absX)*UtilAtanTable::size;
+		int index=std::min((int)ratio, UtilAtanTable::size-1);
+		double units=utilAtanTable.values[index]+(ratio-index)*(utilAtanTable.values[index+1]-utilAtanTable.values[index]);
+
+		// Undo reduction.
+		if (steep)
+			units=binaryAngleFullTurn/4-units;
+		if (x<0.0)
+			units=binaryAngleFullTurn/2-units;
+		int result=units+0.5;
+		return (BinaryAngle)(y<0.0 ? -result : result);
+	}
+
 	int clamp(int x, int a, int b) {
 		return std::max(a, std::min(b, x));
 	}
@@ -1,6 +1,8 @@
 #ifndef TREMORENGINE_UTIL_H
 #define TREMORENGINE_UTIL_H
 
+#include <cstdint>
+
 namespace TremorEngine {
 	typedef long long MicroSeconds;
 	static const MicroSeconds microSecondsPerSecond=1000000llu;
@@ -10,6 +12,15 @@ namespace TremorEngine {
 
 	double angleNormalise(double angle); // adjusts into interval [0, 2pi)
 
+	// Binary angles - a full turn is 65536 units, so angles wrap around by themselves (as unsigned arithmetic) and never need normalising.
+	// One unit is roughly 0.0001 radians.
+	typedef uint16_t BinaryAngle;
+	static const uint32_t binaryAngleFullTurn=65536;
+
+	BinaryAngle binaryAngleFromRadians(double angle); // rounded to nearest unit, any angle accepted
+	double binaryAngleToRadians(BinaryAngle angle); // result in interval [0, 2pi)
+	BinaryAngle binaryAngleAtan2(double y, double x); // as atan2 but table based, at most one unit from the exact result (0 if both x and y are 0)
+
 	int clamp(int x, int a, int b);
 };
 